@@ -0,0 +1,316 @@
+// Micro benchmarks of the simulation kernels. The population they run over
+// comes from a fixed seed ticked for a while, or from a checkpoint, so runs
+// on the same machine can be compared. Every benchmark is repeated and the
+// mean, standard deviation and best of the repetitions are reported.
+//
+// The simulation is included whole, its main renamed out of the way.
+
+#define main eco_main
+#include "game.c"
+#undef main
+
+struct Bench_Result {
+    const char *name;
+    int64_t ops; // Per repetition
+    double *ns; // Per repetition, arr
+};
+
+struct Bench_Result *bench_results; // arr
+int64_t bench_reps = 10;
+
+// Keeps the compiler from throwing the work away
+volatile uint64_t bench_sink;
+
+struct Cell **bench_cells; // arr, the cells in list order
+struct Cell *bench_copies; // For the benchmarks that change cells
+float *bench_inputs; // arr, what the combining functions get
+
+uint64_t bench_begin() {
+    return get_timestamp();
+}
+
+// Repetition -1 warms the caches up and isn't kept
+void bench_end(struct Bench_Result *r, uint64_t start, int64_t rep) {
+    const double ns = get_timestamp() - start;
+    if (rep >= 0) arr_push(&r->ns, ns / r->ops);
+}
+
+// How many times to go over n items so a repetition is long enough to time
+int64_t bench_passes(int64_t n) {
+    return ((1 << 20) + n - 1) / n;
+}
+
+struct Bench_Result *bench_new(const char *name, int64_t ops) {
+    struct Bench_Result r = { name, ops, arr_create(double) };
+    arr_push(&bench_results, r);
+    return bench_results + arr_len(bench_results) - 1;
+}
+
+void bench_rand64() {
+    struct Bench_Result *r = bench_new("rand64", 1 << 22);
+    for (int64_t rep = -1; rep < bench_reps; ++rep) {
+        uint64_t sum = 0;
+        const uint64_t start = bench_begin();
+        for (int64_t i = 0; i < r->ops; ++i) sum += rand64();
+        bench_end(r, start, rep);
+        bench_sink += sum;
+    }
+}
+
+void bench_frandf() {
+    struct Bench_Result *r = bench_new("frandf", 1 << 22);
+    for (int64_t rep = -1; rep < bench_reps; ++rep) {
+        float sum = 0;
+        const uint64_t start = bench_begin();
+        for (int64_t i = 0; i < r->ops; ++i) sum += frandf();
+        bench_end(r, start, rep);
+        bench_sink += sum;
+    }
+}
+
+void bench_comb(const char *name, float (*comb)(float)) {
+    const int64_t n = arr_len(bench_inputs), passes = bench_passes(n);
+    struct Bench_Result *r = bench_new(name, n * passes);
+    for (int64_t rep = -1; rep < bench_reps; ++rep) {
+        float sum = 0;
+        const uint64_t start = bench_begin();
+        for (int64_t p = 0; p < passes; ++p) {
+            for (int64_t i = 0; i < n; ++i) sum += comb(bench_inputs[i]);
+        }
+        bench_end(r, start, rep);
+        bench_sink += sum;
+    }
+}
+
+void bench_similar_color() {
+    const int64_t n = arr_len(bench_cells), passes = bench_passes(n);
+    struct Bench_Result *r = bench_new("similar_color", n * passes);
+    for (int64_t rep = -1; rep < bench_reps; ++rep) {
+        uint64_t sum = 0;
+        const uint64_t start = bench_begin();
+        for (int64_t p = 0; p < passes; ++p) {
+            for (int64_t i = 0; i < n; ++i) sum += similar_color(bench_cells[i]->color);
+        }
+        bench_end(r, start, rep);
+        bench_sink += sum;
+    }
+}
+
+void bench_get_in(const char *name, float (*get_in)(struct Cell *, int8_t, int8_t)) {
+    const int64_t n = arr_len(bench_cells), passes = bench_passes(n);
+    struct Bench_Result *r = bench_new(name, n * passes);
+    for (int64_t rep = -1; rep < bench_reps; ++rep) {
+        float sum = 0;
+        const uint64_t start = bench_begin();
+        for (int64_t p = 0; p < passes; ++p) {
+            for (int64_t i = 0; i < n; ++i) {
+                struct Cell *c = bench_cells[i];
+                sum += get_in(c, c->dir_x, c->dir_y);
+            }
+        }
+        bench_end(r, start, rep);
+        bench_sink += sum;
+    }
+}
+
+void bench_set_brain_inputs() {
+    const int64_t n = arr_len(bench_cells), passes = bench_passes(n);
+    struct Bench_Result *r = bench_new("set_brain_inputs", n * passes);
+    for (int64_t rep = -1; rep < bench_reps; ++rep) {
+        const uint64_t start = bench_begin();
+        for (int64_t p = 0; p < passes; ++p) {
+            for (int64_t i = 0; i < n; ++i) set_brain_inputs(bench_cells[i]);
+        }
+        bench_end(r, start, rep);
+    }
+}
+
+void bench_update_brain(const char *name) {
+    const int64_t n = arr_len(bench_cells), passes = bench_passes(n);
+    struct Bench_Result *r = bench_new(name, n * passes);
+    for (int64_t rep = -1; rep < bench_reps; ++rep) {
+        const uint64_t start = bench_begin();
+        for (int64_t p = 0; p < passes; ++p) {
+            for (int64_t i = 0; i < n; ++i) update_brain(bench_cells[i]);
+        }
+        bench_end(r, start, rep);
+    }
+}
+
+void bench_mutate() {
+    // Mutating the same copies again and again is as good as fresh ones
+    const int64_t n = arr_len(bench_cells), passes = bench_passes(n);
+    struct Bench_Result *r = bench_new("mutate", n * passes);
+    for (int64_t i = 0; i < n; ++i) memcpy(bench_copies + i, bench_cells[i], offsetof(struct Cell, synapses) + synapses_len * sizeof(bench_copies[i].synapses[0]));
+    for (int64_t rep = -1; rep < bench_reps; ++rep) {
+        const uint64_t start = bench_begin();
+        for (int64_t p = 0; p < passes; ++p) {
+            for (int64_t i = 0; i < n; ++i) mutate(bench_copies + i, mutation_chance);
+        }
+        bench_end(r, start, rep);
+    }
+}
+
+// Allocates a batch and frees it in a shuffled order, like cells dying
+// wherever they are in the list. An op is an alloc and a free.
+void bench_alloc_free_cell() {
+    const int64_t batch = cell_arena.cap_max - cell_arena.len < 4096 ? cell_arena.cap_max - cell_arena.len : 4096;
+    struct Bench_Result *r = bench_new("alloc_cell+free_cell", batch * 64);
+    struct Cell **batch_cells = malloc(sizeof(*batch_cells) * batch);
+    for (int64_t rep = -1; rep < bench_reps; ++rep) {
+        uint64_t ns = 0;
+        for (int64_t round = 0; round < 64; ++round) {
+            // The shuffle is not timed
+            uint64_t start = bench_begin();
+            for (int64_t i = 0; i < batch; ++i) batch_cells[i] = alloc_cell(&cell_arena);
+            ns += get_timestamp() - start;
+            for (int64_t i = batch - 1; i > 0; --i) {
+                const int64_t j = rand64() % (i + 1);
+                struct Cell *t = batch_cells[i];
+                batch_cells[i] = batch_cells[j];
+                batch_cells[j] = t;
+            }
+            start = bench_begin();
+            for (int64_t i = 0; i < batch; ++i) free_cell(&cell_arena, batch_cells[i]);
+            ns += get_timestamp() - start;
+        }
+        if (rep >= 0) arr_push(&r->ns, (double)ns / r->ops);
+    }
+    free(batch_cells);
+}
+
+void bench_stats(const struct Bench_Result *r, double *mean, double *stddev, double *best) {
+    const int64_t n = arr_len(r->ns);
+    *mean = 0;
+    *best = r->ns[0];
+    for (int64_t i = 0; i < n; ++i) {
+        *mean += r->ns[i] / n;
+        if (r->ns[i] < *best) *best = r->ns[i];
+    }
+    *stddev = 0;
+    for (int64_t i = 0; i < n; ++i) *stddev += (r->ns[i] - *mean) * (r->ns[i] - *mean) / n;
+    *stddev = sqrt(*stddev);
+}
+
+void bench_print() {
+    printf("%-24s %10s %10s %10s %10s %8s %14s\n", "benchmark", "ops", "ns/op", "stddev", "best", "cv %", "Mops/s");
+    for (int64_t i = 0; i < arr_len(bench_results); ++i) {
+        const struct Bench_Result *r = bench_results + i;
+        double mean, stddev, best;
+        bench_stats(r, &mean, &stddev, &best);
+        printf("%-24s %10ld %10.2f %10.2f %10.2f %8.2f %14.2f\n",
+               r->name, r->ops, mean, stddev, best, 100 * stddev / mean, 1e3 / mean);
+    }
+}
+
+bool bench_write_json(const char *path, uint64_t seed, uint64_t warmup_ticks) {
+    FILE *f = fopen(path, "w");
+    if (!f) return false;
+    fprintf(f, "{\n");
+    fprintf(f, "  \"seed\": %lu,\n", seed);
+    fprintf(f, "  \"tick\": %lu,\n", tick_count);
+    fprintf(f, "  \"warmup_ticks\": %lu,\n", warmup_ticks);
+    fprintf(f, "  \"cells\": %ld,\n", cell_arena.len);
+    fprintf(f, "  \"reps\": %ld,\n", bench_reps);
+    fprintf(f, "  \"benchmarks\": [\n");
+    for (int64_t i = 0; i < arr_len(bench_results); ++i) {
+        const struct Bench_Result *r = bench_results + i;
+        double mean, stddev, best;
+        bench_stats(r, &mean, &stddev, &best);
+        fprintf(f, "    {\"name\": \"%s\", \"ops\": %ld, \"ns_per_op\": %.4f, \"stddev_ns\": %.4f, \"variance_ns2\": %.4f, \"best_ns\": %.4f, \"ops_per_second\": %.1f, \"reps_ns\": [",
+                r->name, r->ops, mean, stddev, stddev * stddev, best, 1e9 / mean);
+        for (int64_t j = 0; j < arr_len(r->ns); ++j) fprintf(f, "%s%.4f", j ? ", " : "", r->ns[j]);
+        fprintf(f, "]}%s\n", i + 1 < arr_len(bench_results) ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+    return !fclose(f);
+}
+
+void bench_usage(const char *name) {
+    eprintf("Usage: %s [options]\n", name);
+    eprintf("    -s SEED    Seed of the population (default 1)\n");
+    eprintf("    -t TICKS   Ticks to grow the population for (default 5000000)\n");
+    eprintf("    -r PATH    Take the population from a checkpoint instead\n");
+    eprintf("    -n REPS    Repetitions of every benchmark (default 10)\n");
+    eprintf("    -j PATH    Also write the results to PATH as JSON\n");
+    eprintf("    -g WxH     Size of the field (default %dx%d)\n", FIELD_W, FIELD_H);
+    eprintf("    -l COUNT   Synapses of every cell (default %d)\n", SYNAPSES_LEN);
+    exit(-1);
+}
+
+int main(int argc, char **argv) {
+    uint64_t seed = 1;
+    uint64_t warmup_ticks = 5000000;
+    const char *json_path = NULL;
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "-s") && i + 1 < argc) seed = atoll(argv[++i]);
+        else if (!strcmp(argv[i], "-t") && i + 1 < argc) warmup_ticks = atoll(argv[++i]);
+        else if (!strcmp(argv[i], "-r") && i + 1 < argc) restore_path = argv[++i];
+        else if (!strcmp(argv[i], "-n") && i + 1 < argc) bench_reps = atoll(argv[++i]);
+        else if (!strcmp(argv[i], "-j") && i + 1 < argc) json_path = argv[++i];
+        else if (!strcmp(argv[i], "-g") && i + 1 < argc) { if (!parse_size(argv[++i], &field_w, &field_h)) bench_usage(argv[0]); }
+        else if (!strcmp(argv[i], "-l") && i + 1 < argc) synapses_len = atoll(argv[++i]);
+        else bench_usage(argv[0]);
+    }
+    if (bench_reps < 1 || field_w < 1 || field_h < 1 || synapses_len < 0 || synapses_len > SYNAPSES_MAX) bench_usage(argv[0]);
+
+    // The slots need room for the rounded synapses of update_brain_lut
+    quantised_brains = true;
+    init_world();
+    quantised_brains = false;
+    select_kernels();
+    if (restore_path) {
+        if (!load_checkpoint(restore_path)) return -1;
+        warmup_ticks = 0;
+    } else {
+        srand64(seed);
+        for (int64_t i = 0; i < initial_cells_len; ++i) create_random_cell();
+        for (uint64_t i = 0; i < warmup_ticks; ++i) do_tick();
+    }
+
+    bench_cells = arr_create(struct Cell *);
+    bench_inputs = arr_create(float);
+    for (struct Cell *it = cell_arena.head; it; it = it->next) {
+        arr_push(&bench_cells, it);
+        // What the brain of the cell sums up for every neuron
+        float sums[NEURONS_LEN] = {};
+        for (int64_t i = 0; i < synapses_len; ++i) {
+            sums[it->synapses[i].dst] += it->neurons[it->synapses[i].src] * it->synapses[i].weight;
+        }
+        for (int64_t i = 0; i < NEURONS_LEN; ++i) arr_push(&bench_inputs, sums[i]);
+    }
+    if (!arr_len(bench_cells)) {
+        eprintf("There are no cells\n");
+        return -1;
+    }
+    bench_copies = malloc(sizeof(*bench_copies) * arr_len(bench_cells));
+    printf("%ld cells at tick %lu\n", cell_arena.len, tick_count);
+
+    bench_results = arr_create(struct Bench_Result);
+    bench_rand64();
+    bench_frandf();
+    bench_comb("comb_sigmoid", comb_sigmoid);
+    bench_comb("comb_cos", comb_cos);
+    bench_similar_color();
+    bench_get_in("get_in_like", get_in_like);
+    bench_get_in("get_in_eatable", get_in_eatable);
+    bench_set_brain_inputs();
+    bench_update_brain("update_brain");
+    // The same cells with their synapses rounded, summed as integers and the
+    // combining functions looked up in tables
+    quantised_brains = true;
+    for (int64_t i = 0; i < arr_len(bench_cells); ++i) quantise_synapses(bench_cells[i]);
+    select_kernels();
+    bench_update_brain("update_brain_lut");
+    quantised_brains = false;
+    select_kernels();
+    bench_mutate();
+    bench_alloc_free_cell();
+
+    bench_print();
+    if (json_path && !bench_write_json(json_path, seed, warmup_ticks)) {
+        eprintf("Could not write %s\n", json_path);
+        return -1;
+    }
+    return 0;
+}
@@ -4,6 +4,18 @@
 # CFLAGS='--std=c11 -Wall -Werror -O2 -ggdb'
 CFLAGS='--std=c11 -Wall -Werror -O2'
 
-LFLAGS='-ldl -lX11 -lGL -lm'
+LFLAGS='-ldl -lX11 -lGL -lm -lpthread'
+SOFT_LFLAGS='-lX11 -lXext -lm -lpthread'
 
 gcc $CFLAGS game.c $LFLAGS -o game
+gcc $CFLAGS -DPISHTOV_SOFTWARE game.c $SOFT_LFLAGS -o game-soft
+gcc $CFLAGS journal_dump.c -lpthread -o journal_dump
+gcc $CFLAGS phylogeny_dump.c -o phylogeny_dump
+gcc $CFLAGS player.c $LFLAGS -o player
+gcc $CFLAGS bench.c $LFLAGS -o bench
+gcc $CFLAGS world_bench.c $LFLAGS -o world_bench
+gcc $CFLAGS -fPIC -shared -fvisibility=hidden libeco.c -lm -lpthread -o libeco.so
+gcc $CFLAGS ensemble.c -L. -leco -Wl,-rpath,'$ORIGIN' -lpthread -o ensemble
+gcc $CFLAGS libeco_test.c -L. -leco -Wl,-rpath,'$ORIGIN' -o libeco_test
+gcc $CFLAGS shard.c $LFLAGS -o shard
+gcc $CFLAGS tiled.c $LFLAGS -o tiled
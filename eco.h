@@ -0,0 +1,145 @@
+#ifndef ECO_H_
+#define ECO_H_
+
+// The simulation as a library, for driving worlds from your own program
+// without the window. Build libeco.so with compile.sh and link with e.g.
+//     gcc harness.c -L. -leco -Wl,-rpath,'$ORIGIN' -o harness
+//
+// A world is created from Eco_Params and stepped a number of sweeps at a
+// time, a sweep being one update of every cell. Worlds are independent and
+// deterministic, the same parameters and seed always end up with the same
+// eco_hash. Any number of them can live in one process and different
+// threads can call into the library at the same time, as long as each world
+// is only used by one thread at a time.
+//
+// What the accessors return points into the world itself. It is only valid
+// until the next eco_step or eco_world_destroy of that world and must not be
+// written to.
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ECO_API __attribute__((visibility("default")))
+
+#define ECO_NEURONS_LEN 28
+#define ECO_SYNAPSES_MAX 64
+
+// Pixels are 0 when empty, otherwise ECO_PIXEL_OCCUPIED, ECO_PIXEL_SLEEPING
+// if the cell is asleep and the colour of the cell as 0xRRGGBB
+#define ECO_PIXEL_OCCUPIED (1u << 31)
+#define ECO_PIXEL_SLEEPING (1u << 24)
+#define ECO_PIXEL_COLOR(pixel) ((pixel) & 0xffffff)
+
+struct Eco_Params {
+    int64_t field_w;
+    int64_t field_h;
+    int64_t initial_cells;
+    int64_t synapses; // Up to ECO_SYNAPSES_MAX
+    float mutation_chance;
+    float minimum_metabolism;
+    float energy_after_mitosis;
+    uint64_t seed;
+    // Keep only the parts of the field with cells on them, for fields too
+    // big to have whole. Such worlds have no eco_pixels.
+    _Bool sparse_field;
+    _Bool quantised_brains; // Brains in fixed point, close to but not the same as floats
+};
+
+// A cell as the simulation keeps it
+struct Eco_Cell {
+    int64_t x;
+    int64_t y;
+    int8_t dir_x;
+    int8_t dir_y;
+
+    uint32_t color;
+    float energy;
+    float metabolism;
+    _Bool sleeping;
+    uint64_t genome; // Equal for cells of one species
+    int64_t lineage; // Only used by game -y
+
+    float neurons[ECO_NEURONS_LEN];
+    int32_t neuron_combs[ECO_NEURONS_LEN]; // 0 sigmoid, 1 cos
+
+    // In the order the cells are updated
+    const struct Eco_Cell *next;
+    const struct Eco_Cell *prev;
+
+    // Only the first Eco_Params.synapses are there, the cells in the arena
+    // end after them
+    struct {
+        int64_t src;
+        int64_t dst;
+        float weight;
+    } synapses[ECO_SYNAPSES_MAX];
+};
+
+// What a world is like now and what its cells did since it was created
+struct Eco_Stats {
+    int64_t population;
+    int64_t sleeping;
+    double mean_energy;
+    double mean_metabolism;
+
+    uint64_t spawns;
+    uint64_t births;
+    uint64_t starved;
+    uint64_t eaten;
+    uint64_t moves;
+    uint64_t sleeps;
+    uint64_t wakes;
+};
+
+// Cells with the same synapses, combining functions and metabolism
+struct Eco_Species {
+    uint64_t genome;
+    int64_t count; // Living cells
+    uint64_t first_tick; // Or the tick of the checkpoint it was loaded from
+    const struct Eco_Cell *representative; // The first cell of it as it was born, next and prev are NULL
+};
+
+struct Eco_World;
+
+// The parameters the game starts with when given no options
+ECO_API struct Eco_Params eco_default_params(void);
+
+// NULL when the parameters are out of range
+ECO_API struct Eco_World *eco_world_create(const struct Eco_Params *params);
+ECO_API void eco_world_destroy(struct Eco_World *world);
+
+// Runs the given number of sweeps and returns how many ticks that took
+ECO_API uint64_t eco_step(struct Eco_World *world, uint64_t sweeps);
+
+ECO_API const struct Eco_Params *eco_params(const struct Eco_World *world);
+ECO_API uint64_t eco_tick(const struct Eco_World *world);
+ECO_API int64_t eco_population(const struct Eco_World *world);
+
+// Walks the cells
+ECO_API struct Eco_Stats eco_stats(const struct Eco_World *world);
+
+// Fills up to max species in no particular order and returns how many there
+// are, without looking at the cells
+ECO_API int64_t eco_species(const struct Eco_World *world, struct Eco_Species *species, int64_t max);
+
+// field_w * field_h pixels, row by row, NULL for a sparse field
+ECO_API const uint32_t *eco_pixels(const struct Eco_World *world);
+
+// Cells on the w x h rectangle at x, y, which must be on the field. Quick on
+// a dense field, on a sparse one it looks at every position.
+ECO_API int64_t eco_occupied(struct Eco_World *world, int64_t x, int64_t y, int64_t w, int64_t h);
+
+// The first of the eco_population cells, the rest follow through next
+ECO_API const struct Eco_Cell *eco_cells(const struct Eco_World *world);
+
+// The same hash world_bench and game -H print
+ECO_API uint64_t eco_hash(struct Eco_World *world);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // ECO_H_
@@ -0,0 +1,304 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "arr.h"
+#include "eco.h"
+
+// Runs many worlds in one process, e.g. the same world with every combination
+// of a few seeds, mutation chances and minimum metabolisms, and writes what
+// each of them ended up like as CSV.
+//
+// Worlds are stepped a chunk of sweeps at a time by a pool of threads, one
+// pinned to every CPU. Every thread has a deque of worlds. It keeps stepping
+// the world on the bottom of its own until that is done, so the world stays in
+// its cache, and when it runs out it steals the top world of another thread.
+// Worlds start out dealt round robin, so they only move when the threads get
+// uneven, e.g. when some worlds die out early.
+
+struct Ensemble_World {
+    struct Eco_Params params;
+    // Created by the thread that first steps it, so its memory is near it
+    struct Eco_World *handle;
+    uint64_t sweeps_left;
+
+    double seconds;
+    uint64_t ticks;
+    struct Eco_Stats stats;
+    uint64_t hash;
+};
+
+struct Ensemble_Deque {
+    pthread_mutex_t mutex;
+    int64_t *worlds; // A ring of indices into ensemble_worlds
+    int64_t top;
+    int64_t len;
+};
+
+struct Ensemble_Worker {
+    pthread_t thread;
+    int64_t id;
+    int cpu; // -1 when not pinned
+    struct Ensemble_Deque deque;
+
+    uint64_t chunks;
+    uint64_t steals;
+    double busy_seconds;
+} __attribute__((aligned(64))); // Threads don't share cache lines
+
+struct Ensemble_World *ensemble_worlds; // arr
+struct Ensemble_Worker *ensemble_workers;
+int64_t ensemble_workers_len;
+uint64_t ensemble_chunk = 10;
+atomic_int_fast64_t ensemble_worlds_left;
+
+double ensemble_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Every deque has room for all the worlds
+void deque_push_bottom(struct Ensemble_Deque *d, int64_t world) {
+    const int64_t cap = arr_len(ensemble_worlds);
+    pthread_mutex_lock(&d->mutex);
+    d->worlds[(d->top + d->len++) % cap] = world;
+    pthread_mutex_unlock(&d->mutex);
+}
+
+bool deque_pop_bottom(struct Ensemble_Deque *d, int64_t *world) {
+    const int64_t cap = arr_len(ensemble_worlds);
+    pthread_mutex_lock(&d->mutex);
+    const bool ok = d->len > 0;
+    if (ok) *world = d->worlds[(d->top + --d->len) % cap];
+    pthread_mutex_unlock(&d->mutex);
+    return ok;
+}
+
+// Gives up when the owner has the deque instead of waiting for it
+bool deque_steal_top(struct Ensemble_Deque *d, int64_t *world) {
+    const int64_t cap = arr_len(ensemble_worlds);
+    if (pthread_mutex_trylock(&d->mutex)) return false;
+    const bool ok = d->len > 0;
+    if (ok) {
+        *world = d->worlds[d->top];
+        d->top = (d->top + 1) % cap;
+        --d->len;
+    }
+    pthread_mutex_unlock(&d->mutex);
+    return ok;
+}
+
+// Tries the next threads first, so thieves spread over the victims
+bool find_world(struct Ensemble_Worker *me, int64_t *world) {
+    if (deque_pop_bottom(&me->deque, world)) return true;
+    for (int64_t i = 1; i < ensemble_workers_len; ++i) {
+        struct Ensemble_Worker *victim = ensemble_workers + (me->id + i) % ensemble_workers_len;
+        if (deque_steal_top(&victim->deque, world)) {
+            ++me->steals;
+            return true;
+        }
+    }
+    return false;
+}
+
+void *ensemble_worker(void *arg) {
+    struct Ensemble_Worker *me = arg;
+    if (me->cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(me->cpu, &set);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set)) {
+            fprintf(stderr, "Could not pin thread %ld to CPU %d\n", me->id, me->cpu);
+            me->cpu = -1;
+        }
+    }
+
+    while (atomic_load(&ensemble_worlds_left) > 0) {
+        int64_t i;
+        if (!find_world(me, &i)) {
+            sched_yield();
+            continue;
+        }
+
+        struct Ensemble_World *w = ensemble_worlds + i;
+        const double start = ensemble_now();
+        if (!w->handle) w->handle = eco_world_create(&w->params);
+        const uint64_t sweeps = w->sweeps_left < ensemble_chunk ? w->sweeps_left : ensemble_chunk;
+        w->ticks += eco_step(w->handle, sweeps);
+        w->sweeps_left -= sweeps;
+
+        if (w->sweeps_left) {
+            deque_push_bottom(&me->deque, i);
+        } else {
+            w->stats = eco_stats(w->handle);
+            w->hash = eco_hash(w->handle);
+            eco_world_destroy(w->handle);
+            w->handle = NULL;
+            atomic_fetch_sub(&ensemble_worlds_left, 1);
+        }
+
+        const double seconds = ensemble_now() - start;
+        w->seconds += seconds;
+        me->busy_seconds += seconds;
+        ++me->chunks;
+    }
+    return NULL;
+}
+
+// Adds a comma separated list of numbers, seeds can also be ranges like 1-8
+void parse_list(const char *s, double **values, bool ranges) {
+    while (*s) {
+        char *end;
+        const double from = strtod(s, &end);
+        if (end == s) break;
+        double to = from;
+        if (ranges && *end == '-') {
+            s = end + 1;
+            to = strtod(s, &end);
+            if (end == s) break;
+        }
+        for (double v = from; v <= to; ++v) arr_push(values, v);
+        if (from > to) break;
+        s = *end == ',' ? end + 1 : end;
+    }
+    if (*s || !arr_len(*values)) {
+        fprintf(stderr, "Could not parse the list %s\n", s);
+        exit(-1);
+    }
+}
+
+void ensemble_usage(const char *name) {
+    struct Eco_Params p = eco_default_params();
+    fprintf(stderr, "Usage: %s [options]\n", name);
+    fprintf(stderr, "Runs a world for every combination of the values of -s, -u and -b\n");
+    fprintf(stderr, "    -s SEEDS      Comma separated seeds or ranges of them like 1-8 (default 1)\n");
+    fprintf(stderr, "    -u CHANCES    Comma separated mutation chances (default %g)\n", p.mutation_chance);
+    fprintf(stderr, "    -b MINIMUMS   Comma separated minimum metabolisms (default %g)\n", p.minimum_metabolism);
+    fprintf(stderr, "    -g WxH        Size of every field (default %ldx%ld)\n", p.field_w, p.field_h);
+    fprintf(stderr, "    -i CELLS      Random cells every world starts with (default %ld)\n", p.initial_cells);
+    fprintf(stderr, "    -l COUNT      Synapses of every cell (default %ld)\n", p.synapses);
+    fprintf(stderr, "    -E FRAC       Fraction of the energy parent and child keep at birth (default %g)\n", p.energy_after_mitosis);
+    fprintf(stderr, "    -n SWEEPS     Sweeps over the cells to run every world for (default 100)\n");
+    fprintf(stderr, "    -c SWEEPS     Sweeps of every step, worlds can only change threads between steps (default 10)\n");
+    fprintf(stderr, "    -t THREADS    Threads to run, 0 for one per CPU (default 0)\n");
+    fprintf(stderr, "    -U            Don't pin the threads to CPUs\n");
+    fprintf(stderr, "    -o PATH       Write the results to PATH instead of stdout\n");
+    exit(-1);
+}
+
+int main(int argc, char **argv) {
+    struct Eco_Params base = eco_default_params();
+    double *seeds = arr_create(double);
+    double *chances = arr_create(double);
+    double *minimums = arr_create(double);
+    uint64_t sweeps = 100;
+    int64_t threads = 0;
+    bool pin = true;
+    const char *out_path = NULL;
+
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "-s") && i + 1 < argc) parse_list(argv[++i], &seeds, true);
+        else if (!strcmp(argv[i], "-u") && i + 1 < argc) parse_list(argv[++i], &chances, false);
+        else if (!strcmp(argv[i], "-b") && i + 1 < argc) parse_list(argv[++i], &minimums, false);
+        else if (!strcmp(argv[i], "-g") && i + 1 < argc) { if (sscanf(argv[++i], "%ldx%ld", &base.field_w, &base.field_h) != 2) ensemble_usage(argv[0]); }
+        else if (!strcmp(argv[i], "-i") && i + 1 < argc) base.initial_cells = atoll(argv[++i]);
+        else if (!strcmp(argv[i], "-l") && i + 1 < argc) base.synapses = atoll(argv[++i]);
+        else if (!strcmp(argv[i], "-E") && i + 1 < argc) base.energy_after_mitosis = atof(argv[++i]);
+        else if (!strcmp(argv[i], "-n") && i + 1 < argc) sweeps = atoll(argv[++i]);
+        else if (!strcmp(argv[i], "-c") && i + 1 < argc) ensemble_chunk = atoll(argv[++i]);
+        else if (!strcmp(argv[i], "-t") && i + 1 < argc) threads = atoll(argv[++i]);
+        else if (!strcmp(argv[i], "-U")) pin = false;
+        else if (!strcmp(argv[i], "-o") && i + 1 < argc) out_path = argv[++i];
+        else ensemble_usage(argv[0]);
+    }
+    if (!arr_len(seeds)) arr_push(&seeds, base.seed);
+    if (!arr_len(chances)) arr_push(&chances, base.mutation_chance);
+    if (!arr_len(minimums)) arr_push(&minimums, base.minimum_metabolism);
+    if (ensemble_chunk < 1 || threads < 0 || base.field_w < 1 || base.field_h < 1 ||
+        base.synapses < 0 || base.synapses > ECO_SYNAPSES_MAX ||
+        base.initial_cells < 0 || base.initial_cells > base.field_w * base.field_h) {
+        ensemble_usage(argv[0]);
+    }
+
+    ensemble_worlds = arr_create(struct Ensemble_World);
+    for (int64_t s = 0; s < arr_len(seeds); ++s) {
+        for (int64_t u = 0; u < arr_len(chances); ++u) {
+            for (int64_t b = 0; b < arr_len(minimums); ++b) {
+                struct Ensemble_World w = { .params = base, .sweeps_left = sweeps };
+                w.params.seed = seeds[s];
+                w.params.mutation_chance = chances[u];
+                w.params.minimum_metabolism = minimums[b];
+                arr_push(&ensemble_worlds, w);
+            }
+        }
+    }
+    const int64_t worlds_len = arr_len(ensemble_worlds);
+
+    // One thread for every CPU we may run on
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    sched_getaffinity(0, sizeof(allowed), &allowed);
+    int *cpus = arr_create(int);
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) if (CPU_ISSET(cpu, &allowed)) arr_push(&cpus, cpu);
+    if (!threads) threads = arr_len(cpus) ? arr_len(cpus) : 1;
+
+    ensemble_workers_len = threads;
+    ensemble_workers = aligned_alloc(64, sizeof(*ensemble_workers) * threads);
+    memset(ensemble_workers, 0, sizeof(*ensemble_workers) * threads);
+    for (int64_t i = 0; i < threads; ++i) {
+        struct Ensemble_Worker *w = ensemble_workers + i;
+        w->id = i;
+        w->cpu = pin && arr_len(cpus) ? cpus[i % arr_len(cpus)] : -1;
+        pthread_mutex_init(&w->deque.mutex, NULL);
+        w->deque.worlds = malloc(sizeof(*w->deque.worlds) * worlds_len);
+    }
+    for (int64_t i = 0; i < worlds_len; ++i) deque_push_bottom(&ensemble_workers[i % threads].deque, i);
+    atomic_store(&ensemble_worlds_left, worlds_len);
+
+    fprintf(stderr, "%ld worlds of %ld sweeps on %ld threads\n", worlds_len, sweeps, threads);
+    const double start = ensemble_now();
+    for (int64_t i = 0; i < threads; ++i) {
+        pthread_create(&ensemble_workers[i].thread, NULL, ensemble_worker, ensemble_workers + i);
+    }
+    for (int64_t i = 0; i < threads; ++i) pthread_join(ensemble_workers[i].thread, NULL);
+    const double seconds = ensemble_now() - start;
+
+    FILE *out = out_path ? fopen(out_path, "w") : stdout;
+    if (!out) {
+        fprintf(stderr, "Could not open %s\n", out_path);
+        return -1;
+    }
+    fprintf(out, "world,seed,mutation_chance,minimum_metabolism,field_w,field_h,initial_cells,sweeps,ticks,seconds,"
+                 "population,sleeping,mean_energy,mean_metabolism,spawns,births,starved,eaten,moves,sleeps,wakes,hash\n");
+    uint64_t ticks = 0;
+    for (int64_t i = 0; i < worlds_len; ++i) {
+        const struct Ensemble_World *w = ensemble_worlds + i;
+        const struct Eco_Stats *s = &w->stats;
+        ticks += w->ticks;
+        fprintf(out, "%ld,%lu,%g,%g,%ld,%ld,%ld,%lu,%lu,%.3f,%ld,%ld,%.4f,%.4f,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%016lx\n",
+                i, w->params.seed, w->params.mutation_chance, w->params.minimum_metabolism,
+                w->params.field_w, w->params.field_h, w->params.initial_cells, sweeps, w->ticks, w->seconds,
+                s->population, s->sleeping, s->mean_energy, s->mean_metabolism,
+                s->spawns, s->births, s->starved, s->eaten, s->moves, s->sleeps, s->wakes, w->hash);
+    }
+    if (out != stdout && fclose(out)) {
+        fprintf(stderr, "Could not write %s\n", out_path);
+        return -1;
+    }
+
+    fprintf(stderr, "%.3f s, %.0f ticks/s\n", seconds, ticks / seconds);
+    fprintf(stderr, "%8s %6s %10s %10s %8s\n", "thread", "cpu", "chunks", "steals", "busy %");
+    for (int64_t i = 0; i < threads; ++i) {
+        const struct Ensemble_Worker *w = ensemble_workers + i;
+        fprintf(stderr, "%8ld %6d %10lu %10lu %8.1f\n", i, w->cpu, w->chunks, w->steals, 100 * w->busy_seconds / seconds);
+    }
+    return 0;
+}
@@ -1,18 +1,56 @@
+#define _GNU_SOURCE
+
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include <assert.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <dirent.h>
+#include <stddef.h>
+#include <errno.h>
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
+// libeco.c builds the simulation without the window, see eco.h
+#ifndef ECO_LIBRARY
+#define PISHTOV_NO_MAIN
 #include "pishtov.h"
+#else
+#define eprintf(...) fprintf(stderr, __VA_ARGS__);
+#endif
+
+// The globals a world is made of, see WORLD_STATE. In the library every thread
+// has its own, so threads can run different worlds at the same time. The
+// initial-exec model keeps that as cheap as a plain global.
+#ifdef ECO_LIBRARY
+#define WORLD_LOCAL _Thread_local __attribute__((tls_model("initial-exec")))
+#else
+#define WORLD_LOCAL
+#endif
+#include "arr.h"
+#include "journal.h"
+#include "phylogeny.h"
+#include "video.h"
+#include "recording.h"
+#include "profile.h"
 
 #define PI 3.141592653589793238
 #define E  2.718281828459045235
 
-// #define FIELD_W 240
-// #define FIELD_H 135
+// The defaults of the world parameters below, which can be changed at startup
+// with options or a config file
+#ifndef FIELD_W
 #define FIELD_W 960
 #define FIELD_H 540
+#endif
 
 #define INITIAL_CELLS_LEN 1000
 #define SYNAPSES_LEN 30
@@ -20,8 +58,30 @@
 #define MINIMUM_METABOLISM 0.f
 #define ENERGY_MULTIPLIED_AFER_MITOSIS .5f
 
+// Cells have room for this many synapses, synapses_len of them are used
+#define SYNAPSES_MAX 64
+
+// The field is also kept at lower resolutions, level l having blocks of
+// 2^l x 2^l cells, so that drawing it zoomed out doesn't look at every cell.
+#define MIP_LEVELS 6
+
+WORLD_LOCAL int64_t field_w = FIELD_W;
+WORLD_LOCAL int64_t field_h = FIELD_H;
+WORLD_LOCAL int64_t initial_cells_len = INITIAL_CELLS_LEN;
+WORLD_LOCAL int64_t synapses_len = SYNAPSES_LEN;
+WORLD_LOCAL float mutation_chance = MUTATION_CHANCE;
+WORLD_LOCAL float minimum_metabolism = MINIMUM_METABOLISM;
+WORLD_LOCAL float energy_multiplied_after_mitosis = ENERGY_MULTIPLIED_AFER_MITOSIS;
+// Think in fixed point with the quantised synapses of the cell arena
+WORLD_LOCAL bool quantised_brains;
+
 float ticks_per_second = 1024000.f;
 float seconds_since_last_tick = 0;
+// Ticking stops for the frame once this much time is spent on it, so drawing
+// and input stay responsive no matter how slow the ticks get.
+float tick_budget_seconds = .012f;
+// Ignore ticks_per_second and tick for the whole budget of every frame
+bool as_fast_as_possible = false;
 
 enum Neuron_Id {
     IN_BIAS,
@@ -64,6 +124,21 @@ enum Combining_Function_Id {
     COMB_LEN,
 };
 
+// Quantised brains keep weights as int8_t with QUANTISED_WEIGHT being 1 and
+// neurons as int16_t with QUANTISED_ONE being 1. Their sums index tables of
+// the combining functions from -QUANTISED_RANGE to QUANTISED_RANGE.
+#define QUANTISED_WEIGHT 128
+#define QUANTISED_ONE (1 << 14)
+#define QUANTISED_RANGE 4
+#define QUANTISED_LUT_SHIFT 12
+#define QUANTISED_LUT_LEN (2 * QUANTISED_RANGE * QUANTISED_WEIGHT * QUANTISED_ONE >> QUANTISED_LUT_SHIFT)
+
+struct Quantised_Synapse {
+    uint8_t src;
+    uint8_t dst;
+    int8_t weight;
+};
+
 struct Cell {
     int64_t x;
     int64_t y;
@@ -74,37 +149,268 @@ struct Cell {
     float energy;
     float metabolism;
     bool sleeping;
+    uint64_t genome; // genome_of the cell, which names its species
+    int64_t lineage; // Its node of the phylogeny, -1 when not recorded
 
     float neurons[NEURONS_LEN];
     enum Combining_Function_Id neuron_combs[NEURONS_LEN];
+
+    struct Cell *next;
+    struct Cell *prev;
+
+    // Last, so a cell only takes the synapses it uses, see cell_size
     struct {
         int64_t src;
         int64_t dst;
         float weight;
-    } synapses[SYNAPSES_LEN];
-
-    struct Cell *next;
-    struct Cell *prev;
+    } synapses[SYNAPSES_MAX];
 };
 
+// The slots are reserved a chunk at a time but only take memory once handed
+// out. The ones below top have been, those of them freed since wait on free to
+// be handed out again first. A dense field has one chunk with a slot for every
+// place, a sparse one adds chunks as big as all before them as it fills up, so
+// its address space goes by the cells too. Slots are cell_size apart, not
+// sizeof(struct Cell), and chunks are anywhere, so go through cell_in_slot and
+// slot_of.
+#define ARENA_CHUNKS_MAX 48
 struct Cell_Arena {
-    int64_t cap; // constant
+    int64_t cap; // The slots of the chunks so far
+    int64_t cap_max; // constant
+    int64_t stride; // constant
     int64_t len;
-    struct Cell *data;
+    int64_t top;
+    uint8_t *data; // The first chunk
+    int64_t chunks_len;
+    uint8_t *chunks[ARENA_CHUNKS_MAX];
+    int64_t chunk_ends[ARENA_CHUNKS_MAX]; // The slot after the last of each chunk
+    int64_t free_len;
     struct Cell **free;
 
     struct Cell *head;
 };
 
-struct Cell *field[FIELD_W][FIELD_H];
+// field_w columns of field_h cells
+WORLD_LOCAL struct Cell **field;
+#define FIELD(x, y) field[(x) * field_h + (y)]
+
+// A sparse field has no field, pixels or mip. It is cut into tiles that only
+// exist while there are cells on them, and the tiles into pages, which only
+// exist while they have tiles, so it takes memory by the cells instead of by
+// its area. field_at and place_cell work on both.
+#define TILE_BITS 4 // Tiles are 16x16 cells
+#define PAGE_BITS 4 // Pages are 16x16 tiles
+#define TILE_SPARES 16 // Emptied tiles kept for reuse, so a cell going back and forth doesn't churn them
+// Even a sparse field can't have more cells than there is address space for
+#define SPARSE_CELLS_MAX (1ll << 32)
+// A sparse field's arena starts with room for this many times the cells it
+// starts with, but no fewer than SPARSE_CHUNK_MIN
+#define SPARSE_ROOM_PER_CELL 4
+#define SPARSE_CHUNK_MIN (1ll << 16)
+
+struct Tile {
+    struct Cell *cells[1 << TILE_BITS << TILE_BITS]; // Columns like field
+    int64_t count;
+};
+
+struct Tile_Page {
+    struct Tile *tiles[1 << PAGE_BITS << PAGE_BITS];
+    int64_t count;
+};
+
+WORLD_LOCAL bool sparse_field;
+// pages_w columns of pages_h pages, NULL where there are no cells
+WORLD_LOCAL struct Tile_Page **tile_pages;
+WORLD_LOCAL int64_t pages_w;
+WORLD_LOCAL int64_t pages_h;
+WORLD_LOCAL int64_t tiles_len;
+WORLD_LOCAL struct Tile *spare_tiles[TILE_SPARES];
+WORLD_LOCAL int64_t spare_tiles_len;
+
+// A bit for every position of a dense field, set where there is a cell, in
+// the order of FIELD. occupancy_counts[0] counts the bits of every block of
+// 64 words and every further level counts 64 blocks of the one below, so
+// finding the nth empty position or counting the cells before one takes a
+// few scans of 64 counts instead of a walk over the field.
+#define OCCUPANCY_LEVELS 4
+#define OCCUPANCY_BLOCK_BITS(level) (12 + 6 * (level)) // log2 of the positions a count covers
+WORLD_LOCAL uint64_t *occupancy;
+WORLD_LOCAL uint32_t *occupancy_counts[OCCUPANCY_LEVELS];
+
+// What is on the field as an image, row by row, for anything that wants to
+// look at it without walking the cells. 0 is an empty pixel.
+#define PIXEL_OCCUPIED (1u << 31)
+#define PIXEL_SLEEPING (1u << 24)
+WORLD_LOCAL uint32_t *pixels;
+
+struct Mip_Block {
+    uint32_t count;
+    uint32_t r, g, b; // Sums of the colours of the cells in the block
+};
+
+// mip[l] has blocks of 2^(l+1) x 2^(l+1) cells, row by row
+WORLD_LOCAL struct Mip_Block *mip[MIP_LEVELS];
+WORLD_LOCAL int64_t mip_w[MIP_LEVELS];
+WORLD_LOCAL int64_t mip_h[MIP_LEVELS];
+
+WORLD_LOCAL struct Cell_Arena cell_arena;
+
+// The synapses_len synapses of a cell and, when quantised_brains, as many
+// rounded ones right after them
+int64_t cell_size() {
+    int64_t size = offsetof(struct Cell, synapses) + synapses_len * sizeof(((struct Cell*)0)->synapses[0]);
+    if (quantised_brains) size += synapses_len * sizeof(struct Quantised_Synapse);
+    return (size + _Alignof(struct Cell) - 1) & -_Alignof(struct Cell);
+}
+
+static inline struct Cell *cell_in_slot(const struct Cell_Arena *ca, int64_t i) {
+    int64_t k = 0;
+    while (i >= ca->chunk_ends[k]) ++k;
+    return (struct Cell *)(ca->chunks[k] + (i - (k ? ca->chunk_ends[k - 1] : 0)) * ca->stride);
+}
+
+static inline int64_t slot_of(const struct Cell *c) {
+    const struct Cell_Arena *ca = &cell_arena;
+    const uint8_t *p = (const uint8_t *)c;
+    int64_t k = 0, first = 0;
+    while (p < ca->chunks[k] || p >= ca->chunks[k] + (ca->chunk_ends[k] - first) * ca->stride) first = ca->chunk_ends[k++];
+    return first + (p - ca->chunks[k]) / ca->stride;
+}
+
+static inline struct Quantised_Synapse *quantised_synapses_of(const struct Cell *c) {
+    return (struct Quantised_Synapse *)(c->synapses + synapses_len);
+}
+
+// The cell do_tick updates next, NULL to start a new sweep over the cells
+WORLD_LOCAL struct Cell *tick_cursor;
+WORLD_LOCAL uint64_t tick_count;
+// While tick_count is behind it we tick as fast as possible to catch up
+uint64_t seek_tick;
+bool paused;
+
+const char *checkpoint_path = "eco.ckpt";
+const char *restore_path;
+// Play back the checkpoints in checkpoint_dir instead of adding to them
+bool replaying;
+
+// Periodic checkpoints are written in the background by a forked child to
+// checkpoint_dir as eco-<tick>.ckpt, keeping the newest checkpoint_retention
+// of them (0 keeps all). The child gets a copy-on-write snapshot of the world
+// so the only stall is the fork itself.
+const char *checkpoint_dir;
+// Spaced by ticks, so a seek never replays more than checkpoint_interval_ticks
+#define CHECKPOINT_INTERVAL_TICKS (1 << 23)
+uint64_t checkpoint_interval_ticks = CHECKPOINT_INTERVAL_TICKS;
+float checkpoint_interval_seconds; // Used instead when checkpoint_interval_ticks is 0
+uint64_t checkpoint_last_tick;
+int64_t checkpoint_retention = 10;
+pid_t checkpoint_pid;
+uint64_t checkpoint_pid_tick;
+uint64_t checkpoint_last_ts;
+uint64_t checkpoint_stall_ns;
+uint64_t checkpoint_max_stall_ns;
+
+// Births, deaths and moves are journaled to journal_path when it is set
+const char *journal_path;
+struct Journal *journal;
+struct Journal_Buffer journal_buffer;
+
+// The family tree of the genomes is written to phylogeny_path when it is set
+const char *phylogeny_path;
+struct Phylogeny *phylogeny;
+
+// Every export_every-th frame of the whole field is written to export_path
+const char *export_path;
+enum Video_Format export_format = VIDEO_Y4M;
+int64_t export_every = 1;
+int64_t export_fps; // 0 to play at the 60 frames a second we draw or, headless, simulate
+struct Video_Writer *exporter;
+
+// Every frame is also recorded to record_path, see recording.h
+const char *record_path;
+uint32_t record_keyframe_interval = 300;
+struct Recording *recorder;
+
+// What the cells did, counted where it happens. Every simulation thread has its
+// own counters so counting is a plain increment, there is only the main one
+// for now. That is about one increment per tick, which doesn't show next to the
+// microsecond a tick takes. Building with -DNO_TELEMETRY compiles it out.
+struct Telemetry_Counters {
+    uint64_t spawns;  // Random cells
+    uint64_t births;  // Mitoses, also when the child dies on arrival
+    uint64_t starved;
+    uint64_t eaten;
+    uint64_t moves;   // Also children moving away from their parent
+    uint64_t sleeps;
+    uint64_t wakes;
+};
+
+#ifndef NO_TELEMETRY
+#define COUNT(counter) (++telemetry_counters.counter)
+#else
+#define COUNT(counter)
+#endif
+
+// tiled.c updates the cells of one world from several threads, which each
+// need their own random numbers and counts
+#ifdef TILED_SWEEPS
+#define THREAD_LOCAL _Thread_local
+#else
+#define THREAD_LOCAL WORLD_LOCAL
+#endif
+
+THREAD_LOCAL struct Telemetry_Counters telemetry_counters;
+
+// Every telemetry_interval ticks the counters are summed and written as a line
+// of CSV to telemetry_path. A line walks all the cells for the means.
+const char *telemetry_path;
+uint64_t telemetry_interval = 1024000;
+uint64_t telemetry_next_tick;
+FILE *telemetry_file;
+
+#ifdef PROFILE
+// The phases include the ones they call, e.g. act has the mutate and place of
+// the children and the cost of measuring those
+enum Profile_Phase_Id {
+    PHASE_SET_BRAIN_INPUTS,
+    PHASE_UPDATE_BRAIN,
+    PHASE_ACT,
+    PHASE_PLACE,
+    PHASE_MUTATE,
+    PHASE_DRAW,
+    PHASE_DRAW_IMAGE_BUFFER,
+    PHASES_LEN,
+};
+
+const char *profile_phase_names[PHASES_LEN] = {
+    [PHASE_SET_BRAIN_INPUTS]  = "set_brain_inputs",
+    [PHASE_UPDATE_BRAIN]      = "update_brain",
+    [PHASE_ACT]               = "act_based_on_brain_outputs",
+    [PHASE_PLACE]             = "place_on_field_or_die",
+    [PHASE_MUTATE]            = "mutate",
+    [PHASE_DRAW]              = "draw",
+    [PHASE_DRAW_IMAGE_BUFFER] = "draw_image_buffer",
+};
+
+// Only one in this many ticks is timed, everything else always is
+#ifndef PROFILE_SAMPLE_TICKS
+#define PROFILE_SAMPLE_TICKS 16
+#endif
+
+void print_profile() {
+    profile_print(stderr, profile_phase_names, PHASES_LEN, true);
+}
+#endif
 
-struct Cell_Arena cell_arena;
+// Without a window a frame is a 60th of a second worth of ticks
+bool headless;
+uint64_t stop_tick; // 0 to never stop
 
 int64_t mod(const int64_t x, const int64_t m) {
     return ((x % m) + m) % m;
 }
 
-static unsigned long xorshf_x=123456789, xorshf_y=362436069, xorshf_z=521288629;
+static THREAD_LOCAL unsigned long xorshf_x=123456789, xorshf_y=362436069, xorshf_z=521288629;
 
 // xorshf96
 // period 2^96-1
@@ -122,10 +428,17 @@ uint64_t rand64() {
     return xorshf_z;
 }
 
+// The same seed always gives the same numbers, whatever was drawn before
+void seed_rand64(uint64_t seed) {
+    xorshf_x = 123456789;
+    xorshf_y = 362436069;
+    xorshf_z = 521288629;
+    for (uint64_t i = 0; i < (seed & 0x0fffff); ++i) rand64();
+}
+
 void srand64(uint64_t seed) {
-    seed &= 0x0fffff;
-    printf("    seed = 0x%lx;\n", seed);
-    for (uint64_t i = 0; i < seed; ++i) rand64();
+    printf("    seed = 0x%lx;\n", seed & 0x0fffff);
+    seed_rand64(seed);
 }
 
 float frandf() {
@@ -138,24 +451,285 @@ uint64_t get_timestamp() {
     return ts.tv_sec * 1000000000 + ts.tv_nsec;
 }
 
-void init_cell_arena(struct Cell_Arena *ca, int64_t cap) {
+#ifdef TILED_SWEEPS
+// Set on the threads of tiled.c while they update the cells of a tile. They
+// leave the list alone and keep who was born and who died in the tile, which
+// are linked in and freed once the sweep is over.
+struct Tiled_Task;
+_Thread_local struct Tiled_Task *tiled_task;
+struct Cell *tiled_alloc_cell(struct Cell_Arena *ca);
+void tiled_free_cell(struct Cell *c);
+#endif
+
+// Cells with the same synapses, combining functions and metabolism are of one
+// species. Every species with living cells is in species_list and in
+// species_table, which is indexed by genome and probed linearly, so how many
+// cells of every species there are is known without looking at the cells.
+struct Species {
+    uint64_t genome;
+    int64_t count;
+    uint64_t first_tick;
+    int64_t index; // In species_list
+    struct Cell representative; // The first cell of the species, as it was born
+};
+
+WORLD_LOCAL struct Species **species_table; // NULL where empty
+WORLD_LOCAL int64_t species_table_cap; // A power of two
+WORLD_LOCAL struct Species **species_list; // arr
+
+static inline uint64_t mix_genome(uint64_t h, uint64_t v) {
+    h = (h ^ v) * 0x9e3779b97f4a7c15;
+    return h ^ h >> 29;
+}
+
+uint64_t genome_of(const struct Cell *c) {
+    uint32_t metabolism;
+    memcpy(&metabolism, &c->metabolism, sizeof(metabolism));
+    uint64_t combs = 0;
+    for (int64_t i = 0; i < NEURONS_LEN; ++i) combs = combs * COMB_LEN + c->neuron_combs[i];
+
+    uint64_t h = mix_genome(mix_genome(0, metabolism), combs);
+    for (int64_t i = 0; i < synapses_len; ++i) {
+        uint32_t weight;
+        memcpy(&weight, &c->synapses[i].weight, sizeof(weight));
+        h = mix_genome(h, (uint64_t)weight << 32 | c->synapses[i].src << 8 | c->synapses[i].dst);
+    }
+    return mix_genome(h, synapses_len);
+}
+
+// Weights of 1 round to the largest int8_t
+void quantise_synapses(struct Cell *c) {
+    struct Quantised_Synapse *q = quantised_synapses_of(c);
+    for (int64_t i = 0; i < synapses_len; ++i) {
+        q[i].src = c->synapses[i].src;
+        q[i].dst = c->synapses[i].dst;
+        q[i].weight = fminf(roundf(c->synapses[i].weight * QUANTISED_WEIGHT), INT8_MAX);
+    }
+}
+
+void init_species() {
+    species_table_cap = 1024;
+    species_table = calloc(species_table_cap, sizeof(*species_table));
+    species_list = arr_create(struct Species *);
+}
+
+void clear_species() {
+    for (int64_t i = 0; i < arr_len(species_list); ++i) free(species_list[i]);
+    memset(species_table, 0, species_table_cap * sizeof(*species_table));
+    // arr_resize can't shrink to nothing
+    ARR_LEN(species_list) = 0;
+}
+
+void deinit_species() {
+    clear_species();
+    free(species_table);
+    arr_free(species_list);
+}
+
+struct Species **species_slot(uint64_t genome) {
+    int64_t i = genome & (species_table_cap - 1);
+    while (species_table[i] && species_table[i]->genome != genome) i = (i + 1) & (species_table_cap - 1);
+    return species_table + i;
+}
+
+// Counts a cell that was just born or placed
+void species_add(const struct Cell *c) {
+#ifdef TILED_SWEEPS
+    // Counted by tiled.c when it links the children in
+    if (tiled_task) return;
+#endif
+    struct Species **slot = species_slot(c->genome);
+    if (!*slot) {
+        // At most half full
+        if (2 * (arr_len(species_list) + 1) > species_table_cap) {
+            species_table_cap *= 2;
+            species_table = realloc(species_table, species_table_cap * sizeof(*species_table));
+            memset(species_table, 0, species_table_cap * sizeof(*species_table));
+            for (int64_t i = 0; i < arr_len(species_list); ++i) *species_slot(species_list[i]->genome) = species_list[i];
+            slot = species_slot(c->genome);
+        }
+        struct Species *new = malloc(offsetof(struct Species, representative.synapses) + synapses_len * sizeof(c->synapses[0]));
+        new->genome = c->genome;
+        new->count = 0;
+        new->first_tick = tick_count;
+        new->index = arr_len(species_list);
+        memcpy(&new->representative, c, offsetof(struct Cell, synapses) + synapses_len * sizeof(c->synapses[0]));
+        new->representative.next = NULL;
+        new->representative.prev = NULL;
+        arr_push(&species_list, new);
+        *slot = new;
+    }
+    ++(*slot)->count;
+}
+
+void species_remove(const struct Cell *c) {
+    struct Species **slot = species_slot(c->genome);
+    // Cells that were never counted, like the ones bench allocates
+    if (!*slot) return;
+    struct Species *s = *slot;
+    if (--s->count) return;
+
+    struct Species *last = species_list[arr_len(species_list) - 1];
+    species_list[s->index] = last;
+    last->index = s->index;
+    // arr_pop can't shrink to nothing
+    --ARR_LEN(species_list);
+    free(s);
+
+    // Moves back whatever was probed past the slot, so probing still finds it
+    int64_t hole = slot - species_table;
+    *slot = NULL;
+    for (int64_t i = (hole + 1) & (species_table_cap - 1); species_table[i]; i = (i + 1) & (species_table_cap - 1)) {
+        const int64_t home = species_table[i]->genome & (species_table_cap - 1);
+        // Whether home is cyclically in (hole, i]
+        const bool stays = hole <= i ? hole < home && home <= i : hole < home || home <= i;
+        if (stays) continue;
+        species_table[hole] = species_table[i];
+        species_table[i] = NULL;
+        hole = i;
+    }
+}
+
+// The pages the big allocations ask for, the cells and the field being
+// looked at all over so that with small ones the TLB keeps missing
+enum Page_Size {
+    PAGES_SMALL,
+    PAGES_TRANSPARENT, // Small pages the kernel may merge into 2 MB ones
+    PAGES_HUGE,        // 2 MB pages from the pool in /proc/sys/vm/nr_hugepages
+};
+enum Page_Size page_size = PAGES_SMALL;
+
+#define HUGE_PAGE_SIZE (2ull << 20)
+#define NODES_MAX 64
+
+// Reservations are whole huge pages, so they can always be huge
+size_t reserved_size(size_t size) {
+    return (size + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+}
+
+// Untouched pages of an anonymous mapping take no memory, and without a
+// reservation it can be much bigger than the memory there is. Huge pages are
+// the exception, they are taken from the pool up front, so when it is too
+// small we make do with transparent ones.
+void *reserve(size_t size) {
+    size = reserved_size(size);
+    void *p = MAP_FAILED;
+    if (page_size == PAGES_HUGE) {
+        p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p == MAP_FAILED) eprintf("Not enough huge pages for %zu MB, asking for transparent ones\n", size >> 20);
+    }
+    if (p == MAP_FAILED) {
+        p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (p == MAP_FAILED) {
+            eprintf("Could not reserve %zu bytes\n", size);
+            exit(-1);
+        }
+        if (page_size != PAGES_SMALL) madvise(p, size, MADV_HUGEPAGE);
+    }
+    return p;
+}
+
+void unreserve(void *p, size_t size) {
+    if (p) munmap(p, reserved_size(size));
+}
+
+// Sums up the pages we got from /proc/self/smaps_rollup, and from
+// /proc/self/numa_maps on which NUMA nodes they are
+void print_page_sizes() {
+    int64_t rss = 0, transparent = 0, huge = 0, kb;
+    char line[4096];
+    FILE *f = fopen("/proc/self/smaps_rollup", "r");
+    if (!f) {
+        eprintf("Could not open /proc/self/smaps_rollup\n");
+        return;
+    }
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "Rss: %ld", &kb) == 1) rss = kb;
+        else if (sscanf(line, "AnonHugePages: %ld", &kb) == 1) transparent = kb;
+        else if (sscanf(line, "Private_Hugetlb: %ld", &kb) == 1) huge += kb;
+        else if (sscanf(line, "Shared_Hugetlb: %ld", &kb) == 1) huge += kb;
+    }
+    fclose(f);
+    printf("pages: %ld MB in 4 kB pages, %ld MB in transparent 2 MB pages, %ld MB in 2 MB huge pages\n",
+           (rss - transparent) >> 10, transparent >> 10, huge >> 10);
+
+    int64_t node_kb[NODES_MAX] = {};
+    f = fopen("/proc/self/numa_maps", "r");
+    if (!f) return;
+    while (fgets(line, sizeof(line), f)) {
+        int64_t page_kb = 4;
+        char *p = strstr(line, "kernelpagesize_kB=");
+        if (p) page_kb = atoll(p + strlen("kernelpagesize_kB="));
+        for (p = strstr(line, " N"); p; p = strstr(p + 1, " N")) {
+            int node;
+            int64_t pages;
+            if (sscanf(p, " N%d=%ld", &node, &pages) == 2 && node >= 0 && node < NODES_MAX) node_kb[node] += pages * page_kb;
+        }
+    }
+    fclose(f);
+    printf("nodes:");
+    for (int64_t i = 0; i < NODES_MAX; ++i) if (node_kb[i]) printf(" %ld MB on node %ld", node_kb[i] >> 10, i);
+    printf("\n");
+}
+
+// Starts with a chunk of cap slots, which can grow to cap_max
+void init_cell_arena(struct Cell_Arena *ca, int64_t cap, int64_t cap_max) {
     ca->cap = cap;
+    ca->cap_max = cap_max;
     ca->len = 0;
+    ca->top = 0;
+    ca->free_len = 0;
     ca->head = NULL;
-    ca->data = malloc((sizeof(*ca->data) + sizeof(*ca->free)) * ca->cap);
-    ca->free = (void*)ca->data + sizeof(*ca->data) * ca->cap;
+    ca->stride = cell_size();
+    ca->data = reserve(ca->stride * ca->cap);
+    ca->chunks_len = 1;
+    ca->chunks[0] = ca->data;
+    ca->chunk_ends[0] = ca->cap;
+    ca->free = reserve(sizeof(*ca->free) * ca->cap);
+}
 
-    for (int64_t i = 0; i < ca->cap; ++i) {
-        ca->free[i] = ca->data + i;
+void deinit_cell_arena(struct Cell_Arena *ca) {
+    for (int64_t k = 0; k < ca->chunks_len; ++k) {
+        unreserve(ca->chunks[k], ca->stride * (ca->chunk_ends[k] - (k ? ca->chunk_ends[k - 1] : 0)));
     }
+    unreserve(ca->free, sizeof(*ca->free) * ca->cap);
 }
 
-void deinit_cell_arena(struct Cell_Arena *ca) {
-    free(ca->data);
+// Adds a chunk as big as all before it, or what is left up to cap_max. The
+// cells stay where they are, only free moves.
+bool grow_cell_arena(struct Cell_Arena *ca) {
+    if (ca->cap == ca->cap_max || ca->chunks_len == ARENA_CHUNKS_MAX) return false;
+    const int64_t slots = ca->cap < ca->cap_max - ca->cap ? ca->cap : ca->cap_max - ca->cap;
+    struct Cell **free = reserve(sizeof(*free) * (ca->cap + slots));
+    memcpy(free, ca->free, sizeof(*free) * ca->free_len);
+    unreserve(ca->free, sizeof(*free) * ca->cap);
+    ca->free = free;
+    ca->chunks[ca->chunks_len] = reserve(ca->stride * slots);
+    ca->cap += slots;
+    ca->chunk_ends[ca->chunks_len++] = ca->cap;
+    return true;
+}
+
+// A slot no cell is in, freed ones first
+struct Cell *take_slot(struct Cell_Arena *ca) {
+    struct Cell *new;
+    if (ca->free_len) {
+        new = ca->free[--ca->free_len];
+    } else if (ca->top < ca->cap || grow_cell_arena(ca)) {
+        new = cell_in_slot(ca, ca->top++);
+    } else {
+        eprintf("Out of cells, there can be at most %ld\n", ca->cap_max);
+        exit(-1);
+    }
+    ++ca->len;
+    return new;
 }
 
 struct Cell *alloc_cell(struct Cell_Arena *ca) {
-    struct Cell *new = ca->free[ca->len++];
+#ifdef TILED_SWEEPS
+    if (tiled_task) return tiled_alloc_cell(ca);
+#endif
+    struct Cell *new = take_slot(ca);
 
     new->next = ca->head;
     new->prev = NULL;
@@ -168,11 +742,20 @@ struct Cell *alloc_cell(struct Cell_Arena *ca) {
 }
 
 void free_cell(struct Cell_Arena *ca, struct Cell *c) {
+#ifdef TILED_SWEEPS
+    if (tiled_task) {
+        tiled_free_cell(c);
+        return;
+    }
+#endif
+    species_remove(c);
+    if (phylogeny) phylogeny_release(phylogeny, c->lineage, tick_count);
     if (c->prev) c->prev->next = c->next;
     if (c->next) c->next->prev = c->prev;
     if (ca->head == c) ca->head = c->next;
 
-    ca->free[--ca->len] = c;
+    ca->free[ca->free_len++] = c;
+    --ca->len;
 }
 
 float comb_sigmoid(float x) {
@@ -185,96 +768,388 @@ float comb_cos(float x) {
     return -cosf(PI * x);
 }
 
+void init_mip() {
+    for (int64_t l = 0; l < MIP_LEVELS; ++l) {
+        mip_w[l] = (field_w + (2 << l) - 1) >> (l + 1);
+        mip_h[l] = (field_h + (2 << l) - 1) >> (l + 1);
+        mip[l] = calloc(mip_w[l] * mip_h[l], sizeof(*mip[l]));
+    }
+}
+
+uint32_t cell_draw_color(struct Cell *c) {
+    return c->sleeping ? 0x808080 : c->color;
+}
+
+void add_to_mip(struct Cell *c, int32_t sign) {
+#ifdef TILED_SWEEPS
+    // Nothing draws it and neighbouring tiles share its blocks
+    return;
+#endif
+    const uint32_t color = cell_draw_color(c);
+    for (int64_t l = 0; l < MIP_LEVELS; ++l) {
+        struct Mip_Block *b = &mip[l][(c->y >> (l + 1)) * mip_w[l] + (c->x >> (l + 1))];
+        b->count += sign;
+        b->r += sign * (color >> 16 & 0xff);
+        b->g += sign * (color >>  8 & 0xff);
+        b->b += sign * (color       & 0xff);
+    }
+}
+
+void init_occupancy() {
+    const int64_t len = field_w * field_h;
+    occupancy = calloc((len + 63) >> 6, sizeof(*occupancy));
+    for (int64_t l = 0; l < OCCUPANCY_LEVELS; ++l) {
+        const int64_t blocks = ((len - 1) >> OCCUPANCY_BLOCK_BITS(l)) + 1;
+        occupancy_counts[l] = calloc(blocks, sizeof(*occupancy_counts[l]));
+    }
+}
+
+void clear_occupancy() {
+    const int64_t len = field_w * field_h;
+    memset(occupancy, 0, ((len + 63) >> 6) * sizeof(*occupancy));
+    for (int64_t l = 0; l < OCCUPANCY_LEVELS; ++l) {
+        memset(occupancy_counts[l], 0, (((len - 1) >> OCCUPANCY_BLOCK_BITS(l)) + 1) * sizeof(*occupancy_counts[l]));
+    }
+}
+
+void deinit_occupancy() {
+    free(occupancy);
+    for (int64_t l = 0; l < OCCUPANCY_LEVELS; ++l) free(occupancy_counts[l]);
+}
+
+static inline void set_occupied(int64_t i, bool occupied) {
+    const uint64_t bit = 1ull << (i & 63);
+#ifdef TILED_SWEEPS
+    // Neighbouring tiles share words and blocks
+    if (occupied) __atomic_fetch_or(&occupancy[i >> 6], bit, __ATOMIC_RELAXED);
+    else __atomic_fetch_and(&occupancy[i >> 6], ~bit, __ATOMIC_RELAXED);
+    for (int64_t l = 0; l < OCCUPANCY_LEVELS; ++l) {
+        __atomic_fetch_add(&occupancy_counts[l][i >> OCCUPANCY_BLOCK_BITS(l)], occupied ? 1 : -1, __ATOMIC_RELAXED);
+    }
+#else
+    if (occupied) occupancy[i >> 6] |= bit;
+    else occupancy[i >> 6] &= ~bit;
+    for (int64_t l = 0; l < OCCUPANCY_LEVELS; ++l) occupancy_counts[l][i >> OCCUPANCY_BLOCK_BITS(l)] += occupied ? 1 : -1;
+#endif
+}
+
+// Cells at positions before i, in the order of FIELD
+int64_t occupied_before(int64_t i) {
+    int64_t sum = 0, from = 0;
+    for (int64_t l = OCCUPANCY_LEVELS - 1; l >= 0; --l) {
+        const int64_t to = i >> OCCUPANCY_BLOCK_BITS(l);
+        for (int64_t b = from; b < to; ++b) sum += occupancy_counts[l][b];
+        from = to << 6;
+    }
+    for (int64_t w = from; w < i >> 6; ++w) sum += __builtin_popcountll(occupancy[w]);
+    if (i & 63) sum += __builtin_popcountll(occupancy[i >> 6] & ((1ull << (i & 63)) - 1));
+    return sum;
+}
+
+// The position of the nth empty position, counting from 0. There must be
+// more than n of them.
+int64_t nth_empty(int64_t n) {
+    const int64_t len = field_w * field_h;
+    int64_t from = 0;
+    for (int64_t l = OCCUPANCY_LEVELS - 1; l >= 0; --l) {
+        const int64_t bits = OCCUPANCY_BLOCK_BITS(l);
+        for (int64_t b = from;; ++b) {
+            const int64_t start = b << bits;
+            const int64_t size = (len - start < 1ll << bits ? len - start : 1ll << bits);
+            const int64_t empty = size - occupancy_counts[l][b];
+            if (n < empty) {
+                from = b << 6;
+                break;
+            }
+            n -= empty;
+        }
+    }
+    for (int64_t w = from;; ++w) {
+        const int64_t size = len - (w << 6) < 64 ? len - (w << 6) : 64;
+        uint64_t empty = ~occupancy[w] & (size == 64 ? ~0ull : (1ull << size) - 1);
+        if (n < __builtin_popcountll(empty)) {
+            while (n--) empty &= empty - 1;
+            return (w << 6) + __builtin_ctzll(empty);
+        }
+        n -= __builtin_popcountll(empty);
+    }
+}
+
+// Cells on the w x h rectangle at x, y of a dense field, which must not wrap
+int64_t occupied_in(int64_t x, int64_t y, int64_t w, int64_t h) {
+    if (h == field_h) return occupied_before((x + w) * field_h) - occupied_before(x * field_h);
+    int64_t sum = 0;
+    for (int64_t i = x; i < x + w; ++i) {
+        sum += occupied_before(i * field_h + y + h) - occupied_before(i * field_h + y);
+    }
+    return sum;
+}
+
+// A shard of a bigger field, see shard.c, has a column of ghosts on either
+// side mirroring the neighbouring shards. Cells never land on them, they are
+// given to hand_off instead, which takes them off the list.
+void (*hand_off)(struct Cell *c);
+
+uint32_t cell_pixel(struct Cell *c) {
+    return PIXEL_OCCUPIED | (c->sleeping ? PIXEL_SLEEPING : 0) | c->color;
+}
+
+#define TILE_MASK ((1 << TILE_BITS) - 1)
+#define PAGE_MASK ((1 << PAGE_BITS) - 1)
+
+static inline struct Tile_Page **page_of(int64_t x, int64_t y) {
+    return &tile_pages[(x >> (TILE_BITS + PAGE_BITS)) * pages_h + (y >> (TILE_BITS + PAGE_BITS))];
+}
+
+static inline struct Tile **tile_of(struct Tile_Page *p, int64_t x, int64_t y) {
+    return &p->tiles[(x >> TILE_BITS & PAGE_MASK) << PAGE_BITS | (y >> TILE_BITS & PAGE_MASK)];
+}
+
+static inline struct Cell **cell_of(struct Tile *t, int64_t x, int64_t y) {
+    return &t->cells[(x & TILE_MASK) << TILE_BITS | (y & TILE_MASK)];
+}
+
+static inline struct Cell *tile_cell(int64_t x, int64_t y) {
+    struct Tile_Page *p = *page_of(x, y);
+    if (!p) return NULL;
+    struct Tile *t = *tile_of(p, x, y);
+    return t ? *cell_of(t, x, y) : NULL;
+}
+
+static inline struct Cell *field_at(int64_t x, int64_t y) {
+    return sparse_field ? tile_cell(x, y) : FIELD(x, y);
+}
+
+void set_tile_cell(int64_t x, int64_t y, struct Cell *c) {
+    struct Tile_Page **p = page_of(x, y);
+    if (!*p) *p = calloc(1, sizeof(**p));
+    struct Tile **t = tile_of(*p, x, y);
+    if (!*t) {
+        *t = spare_tiles_len ? spare_tiles[--spare_tiles_len] : calloc(1, sizeof(**t));
+        ++(*p)->count;
+        ++tiles_len;
+    }
+
+    struct Cell **slot = cell_of(*t, x, y);
+    (*t)->count += (c != NULL) - (*slot != NULL);
+    *slot = c;
+
+    if ((*t)->count) return;
+    // Empty tiles are all NULL, as a new one must be
+    if (spare_tiles_len < TILE_SPARES) spare_tiles[spare_tiles_len++] = *t;
+    else free(*t);
+    *t = NULL;
+    --tiles_len;
+    if (--(*p)->count) return;
+    free(*p);
+    *p = NULL;
+}
+
+void init_tiles() {
+    pages_w = (field_w + (1 << (TILE_BITS + PAGE_BITS)) - 1) >> (TILE_BITS + PAGE_BITS);
+    pages_h = (field_h + (1 << (TILE_BITS + PAGE_BITS)) - 1) >> (TILE_BITS + PAGE_BITS);
+    tile_pages = calloc(pages_w * pages_h, sizeof(*tile_pages));
+    tiles_len = 0;
+    spare_tiles_len = 0;
+}
+
+// Frees every tile and page, leaving an empty field
+void clear_tiles() {
+    for (int64_t i = 0; i < pages_w * pages_h; ++i) {
+        if (!tile_pages[i]) continue;
+        for (int64_t j = 0; j < 1 << PAGE_BITS << PAGE_BITS; ++j) free(tile_pages[i]->tiles[j]);
+        free(tile_pages[i]);
+        tile_pages[i] = NULL;
+    }
+    tiles_len = 0;
+}
+
+void deinit_tiles() {
+    clear_tiles();
+    while (spare_tiles_len) free(spare_tiles[--spare_tiles_len]);
+    free(tile_pages);
+}
+
+// Every write to the field goes through these two so the occupancy, the mip
+// and the pixels stay in sync
+void place_cell(struct Cell *c) {
+    if (sparse_field) {
+        set_tile_cell(c->x, c->y, c);
+        return;
+    }
+    FIELD(c->x, c->y) = c;
+    set_occupied(c->x * field_h + c->y, true);
+    pixels[c->y * field_w + c->x] = cell_pixel(c);
+    add_to_mip(c, 1);
+}
+
+void unplace_cell(struct Cell *c) {
+    if (sparse_field) {
+        set_tile_cell(c->x, c->y, NULL);
+        return;
+    }
+    FIELD(c->x, c->y) = NULL;
+    set_occupied(c->x * field_h + c->y, false);
+    pixels[c->y * field_w + c->x] = 0;
+    add_to_mip(c, -1);
+}
+
+// Darts are cheapest while most of the field is empty, only a full one needs
+// the occupancy
+#define EMPTY_DARTS 16
+
+// A position with no cell on it, every one as likely. False when there is
+// none, or on a sparse field when the darts all miss.
+bool random_empty_position(int64_t *x, int64_t *y) {
+    for (int64_t tries = 0; tries < EMPTY_DARTS; ++tries) {
+        *x = hand_off ? 1 + rand64() % (field_w - 2) : rand64() % field_w;
+        *y = rand64() % field_h;
+        if (!field_at(*x, *y)) return true;
+    }
+    if (sparse_field) return false;
+
+    // Not on the ghost columns of a shard
+    const int64_t from = hand_off ? field_h : 0;
+    const int64_t to = hand_off ? (field_w - 1) * field_h : field_w * field_h;
+    const int64_t empty_before = from - occupied_before(from);
+    const int64_t empty = to - from - (occupied_before(to) - occupied_before(from));
+    if (!empty) return false;
+    const int64_t i = nth_empty(empty_before + rand64() % empty);
+    *x = i / field_h;
+    *y = i % field_h;
+    return true;
+}
+
 void create_random_cell() {
-    struct Cell *new = alloc_cell(&cell_arena);
+    int64_t x, y;
+    if (!random_empty_position(&x, &y)) return;
 
-    int64_t tries = 0;
-    do {
-        new->x = rand64() % FIELD_W;
-        new->y = rand64() % FIELD_H;
-        if (++tries > 100) return;
-    } while (field[new->x][new->y]);
+    struct Cell *new = alloc_cell(&cell_arena);
+    new->x = x;
+    new->y = y;
     {
         int8_t dir = rand64() % 4;
         new->dir_x = ( dir & 1) * -(dir >> 1);
         new->dir_y = (~dir & 1) * -(dir >> 1);
     }
     new->color = rand64() & 0xffffff;
-    new->metabolism = frandf() + MINIMUM_METABOLISM;
+    new->metabolism = frandf() + minimum_metabolism;
     new->energy = 1.f;
     new->sleeping = false;
-    for (int64_t i = 0; i < SYNAPSES_LEN; ++i) {
+    for (int64_t i = 0; i < synapses_len; ++i) {
         new->synapses[i].src = rand64() % NEURONS_LEN;
         new->synapses[i].dst = rand64() % NEURONS_LEN;
         new->synapses[i].weight = frandf() * 2.f - 1.f;
     }
     for (int64_t i = 0; i < NEURONS_LEN; ++i) {
         new->neuron_combs[i] = rand64() % COMB_LEN;
+        // Otherwise whatever was last in the arena slot leaks into the
+        // brain and runs stop being reproducible
+        new->neurons[i] = 0.f;
     }
-
-    field[new->x][new->y] = new;
-}
-
-void init() {
-    srand64(get_timestamp());
-
-    // Add ten cells of breathing space
-    init_cell_arena(&cell_arena, FIELD_W * FIELD_H + 10);
-
-    for (uint64_t i = 0; i < INITIAL_CELLS_LEN; ++i) {
-        create_random_cell(&cell_arena);
-    }
+    new->genome = genome_of(new);
+    if (quantised_brains) quantise_synapses(new);
+    species_add(new);
+    new->lineage = phylogeny ? phylogeny_add(phylogeny, -1, tick_count, 0, new->genome) : -1;
+
+    place_cell(new);
+    if (journal) journal_birth(&journal_buffer, tick_count, slot_of(new), -1, new->x, new->y, new->color);
+    COUNT(spawns);
 }
 
-float get_in_like(struct Cell *c, int8_t dx, int8_t dy) {
-    struct Cell *other = field[mod(c->x + dx, FIELD_W)][mod(c->y + dy, FIELD_H)];
+static inline float in_like(const struct Cell *c, const struct Cell *other) {
     if (!other) return 0.f;
     uint32_t diff = other->color ^ c->color;
     diff = (diff & 0xff) | (diff >> 8 & 0xff) | (diff >> 16 & 0xff);
     return diff / 128.f - 1.f;
 }
 
-float get_in_eatable(struct Cell *c, int8_t dx, int8_t dy) {
-    struct Cell *other = field[mod(c->x + dx, FIELD_W)][mod(c->y + dy, FIELD_H)];
+static inline float in_eatable(const struct Cell *c, const struct Cell *other) {
     if (!other) return 0.f;
     return other->sleeping || c->energy > other->energy ? 1.f : -1.f;
 }
 
-// True if dead
+float get_in_like(struct Cell *c, int8_t dx, int8_t dy) {
+    return in_like(c, field_at(mod(c->x + dx, field_w), mod(c->y + dy, field_h)));
+}
+
+float get_in_eatable(struct Cell *c, int8_t dx, int8_t dy) {
+    return in_eatable(c, field_at(mod(c->x + dx, field_w), mod(c->y + dy, field_h)));
+}
+
+// True if dead or handed off
 bool place_on_field_or_die(struct Cell *c) {
+    if (hand_off && (c->x == 0 || c->x == field_w - 1)) {
+        hand_off(c);
+        return true;
+    }
+
     float eatable = get_in_eatable(c, 0, 0);
 
     if (eatable == 0.f) {
-        field[c->x][c->y] = c;
+        place_cell(c);
         return false;
     }
 
-    float energy_sum = fmin(1.f, c->energy + field[c->x][c->y]->energy);
+    struct Cell *other = field_at(c->x, c->y);
+    float energy_sum = fmin(1.f, c->energy + other->energy);
 
     if (eatable == 1.f) {
+        struct Cell *eaten = other;
         c->energy = energy_sum;
-        free_cell(&cell_arena, field[c->x][c->y]);
-        field[c->x][c->y] = c;
+        if (journal) journal_death(&journal_buffer, tick_count, slot_of(eaten), true);
+        COUNT(eaten);
+        unplace_cell(eaten);
+        free_cell(&cell_arena, eaten);
+        place_cell(c);
         return false;
     } else {
-        field[c->x][c->y]->energy = energy_sum;
+        other->energy = energy_sum;
+        if (journal) journal_death(&journal_buffer, tick_count, slot_of(c), true);
+        COUNT(eaten);
         free_cell(&cell_arena, c);
         return true;
     }
 }
 
-void set_brain_inputs(struct Cell *c) {
+// The brain kernels are instantiated for common world parameters, where the
+// wrapping around the field and the synapse loop are constant, and
+// set_brain_inputs and update_brain point to the ones select_kernels picks.
+// The generic ones cover everything else.
+#define ALWAYS_INLINE static inline __attribute__((always_inline))
+
+WORLD_LOCAL int64_t field_h_log2; // When field_h is a power of two
+
+// v is at most one cell off the field
+ALWAYS_INLINE int64_t wrap(int64_t v, int64_t len, bool pow2) {
+    if (pow2) return v & (len - 1);
+    return v < 0 ? v + len : v >= len ? v - len : v;
+}
+
+ALWAYS_INLINE struct Cell *neighbour(const struct Cell *c, int8_t dx, int8_t dy, bool pow2, bool sparse) {
+    const int64_t x = wrap(c->x + dx, field_w, pow2), y = wrap(c->y + dy, field_h, pow2);
+    if (sparse) return tile_cell(x, y);
+    return pow2 ? field[x << field_h_log2 | y] : FIELD(x, y);
+}
+
+// The same as set_brain_inputs_reference, looking at every neighbour once
+ALWAYS_INLINE void set_brain_inputs_kernel(struct Cell *c, bool pow2, bool sparse) {
+    const struct Cell *u = neighbour(c,  c->dir_x,  c->dir_y, pow2, sparse);
+    const struct Cell *l = neighbour(c, -c->dir_y,  c->dir_x, pow2, sparse);
+    const struct Cell *d = neighbour(c, -c->dir_x, -c->dir_y, pow2, sparse);
+    const struct Cell *r = neighbour(c,  c->dir_x, -c->dir_x, pow2, sparse);
+
     c->neurons[IN_BIAS] = 1.f;
 
-    c->neurons[IN_LIKE_U] = get_in_like(c,  c->dir_x,  c->dir_y);
-    c->neurons[IN_LIKE_L] = get_in_like(c, -c->dir_y,  c->dir_x);
-    c->neurons[IN_LIKE_D] = get_in_like(c, -c->dir_x, -c->dir_y);
-    c->neurons[IN_LIKE_R] = get_in_like(c,  c->dir_x, -c->dir_x);
+    c->neurons[IN_LIKE_U] = in_like(c, u);
+    c->neurons[IN_LIKE_L] = in_like(c, l);
+    c->neurons[IN_LIKE_D] = in_like(c, d);
+    c->neurons[IN_LIKE_R] = in_like(c, r);
 
-    c->neurons[IN_EATABLE_U] = get_in_eatable(c,  c->dir_x,  c->dir_y);
-    c->neurons[IN_EATABLE_L] = get_in_eatable(c, -c->dir_y,  c->dir_x);
-    c->neurons[IN_EATABLE_D] = get_in_eatable(c, -c->dir_x, -c->dir_y);
-    c->neurons[IN_EATABLE_R] = get_in_eatable(c,  c->dir_x, -c->dir_x);
+    c->neurons[IN_EATABLE_U] = in_eatable(c, u);
+    c->neurons[IN_EATABLE_L] = in_eatable(c, l);
+    c->neurons[IN_EATABLE_D] = in_eatable(c, d);
+    c->neurons[IN_EATABLE_R] = in_eatable(c, r);
 
     c->neurons[IN_NORTH_U] = c->dir_y == -1 ? 1.f : -1.f;
     c->neurons[IN_NORTH_L] = c->dir_x == -1 ? 1.f : -1.f;
@@ -284,10 +1159,15 @@ void set_brain_inputs(struct Cell *c) {
     c->neurons[IN_ENERGY] = c->energy * 2.f - 1.f;
 }
 
-void update_brain(struct Cell *c) {
+void set_brain_inputs_generic(struct Cell *c) { set_brain_inputs_kernel(c, false, false); }
+void set_brain_inputs_pow2   (struct Cell *c) { set_brain_inputs_kernel(c, true,  false); }
+void set_brain_inputs_sparse (struct Cell *c) { set_brain_inputs_kernel(c, false, true);  }
+
+ALWAYS_INLINE void update_brain_kernel(struct Cell *c, int64_t synapses) {
     float new_neurons[NEURONS_LEN] = {};
 
-    for (int32_t i = 0; i < SYNAPSES_LEN; ++i) {
+#pragma GCC unroll 64
+    for (int32_t i = 0; i < synapses; ++i) {
         new_neurons[c->synapses[i].dst] += c->neurons[c->synapses[i].src] * c->synapses[i].weight;
     }
 
@@ -300,83 +1180,389 @@ void update_brain(struct Cell *c) {
     }
 }
 
-void kill_cell(struct Cell *c) {
-    field[c->x][c->y] = NULL;
-    free_cell(&cell_arena, c);
+void update_brain_generic(struct Cell *c) { update_brain_kernel(c, synapses_len); }
+void update_brain_8 (struct Cell *c) { update_brain_kernel(c,  8); }
+void update_brain_16(struct Cell *c) { update_brain_kernel(c, 16); }
+void update_brain_30(struct Cell *c) { update_brain_kernel(c, 30); }
+void update_brain_32(struct Cell *c) { update_brain_kernel(c, 32); }
+void update_brain_64(struct Cell *c) { update_brain_kernel(c, 64); }
+
+// The combining functions at the middle of every step of the sums. Rows have
+// an entry more, so that activate_quantised_avx2 gathering the last entry as
+// int32_t doesn't read past the table.
+#define COMB_LUT_STRIDE (QUANTISED_LUT_LEN + 1)
+int16_t comb_luts[COMB_LEN][COMB_LUT_STRIDE];
+
+void fill_comb_luts() {
+    for (int64_t i = 0; i < QUANTISED_LUT_LEN; ++i) {
+        const float x = (i - QUANTISED_LUT_LEN / 2 + .5f) / (QUANTISED_LUT_LEN / 2) * QUANTISED_RANGE;
+        comb_luts[COMB_SIGMOID][i] = roundf(comb_sigmoid(x) * QUANTISED_ONE);
+        comb_luts[COMB_COS][i] = roundf(comb_cos(x) * QUANTISED_ONE);
+    }
 }
 
-uint32_t similar_color(uint32_t col) {
-    uint32_t r = (rand64() & 0xf0) | 0x10;
-    uint32_t g = (rand64() & 0xf0) | 0x10;
-    uint32_t b = (rand64() & 0xf0) | 0x10;
+// Shared by the worlds, which libeco may create on several threads
+void init_comb_luts() {
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+    pthread_once(&once, fill_comb_luts);
+}
 
-    r = (r & -r) - 1;
-    g = (g & -g) - 1;
-    b = (b & -b) - 1;
+// Whether activate_quantised_avx2 can be used
+WORLD_LOCAL bool quantised_avx2;
 
-    return col ^ (r << 16 | g << 8 | b);
+// Looks the new neurons up from the sums of the synapses
+ALWAYS_INLINE void activate_quantised(struct Cell *c, const int32_t *sums) {
+    for (int32_t i = 0; i < NEURONS_LEN; ++i) {
+        int32_t at = (sums[i] >> QUANTISED_LUT_SHIFT) + QUANTISED_LUT_LEN / 2;
+        at = at < 0 ? 0 : at >= QUANTISED_LUT_LEN ? QUANTISED_LUT_LEN - 1 : at;
+        c->neurons[i] = comb_luts[c->neuron_combs[i]][at] * (1.f / QUANTISED_ONE);
+    }
 }
 
-void mutate(struct Cell *c, float mutation_chance) {
-    if (frandf() < mutation_chance) {
-        c->metabolism = frandf() + MINIMUM_METABOLISM;
-        c->color = similar_color(c->color);
+#ifdef __x86_64__
+// The same eight neurons at a time, the last ones masked off
+__attribute__((target("avx2")))
+void activate_quantised_avx2(struct Cell *c, const int32_t *sums) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i middle = _mm256_set1_epi32(QUANTISED_LUT_LEN / 2);
+    const __m256i last = _mm256_set1_epi32(QUANTISED_LUT_LEN - 1);
+    const __m256 scale = _mm256_set1_ps(1.f / QUANTISED_ONE);
+    const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    for (int32_t i = 0; i < NEURONS_LEN; i += 8) {
+        const __m256i mask = _mm256_cmpgt_epi32(_mm256_set1_epi32(NEURONS_LEN - i), lanes);
+        __m256i at = _mm256_srai_epi32(_mm256_maskload_epi32(sums + i, mask), QUANTISED_LUT_SHIFT);
+        at = _mm256_min_epi32(_mm256_max_epi32(_mm256_add_epi32(at, middle), zero), last);
+        const __m256i comb = _mm256_maskload_epi32((const int32_t *)c->neuron_combs + i, mask);
+        at = _mm256_add_epi32(at, _mm256_mullo_epi32(comb, _mm256_set1_epi32(COMB_LUT_STRIDE)));
+        // Gathered as int32_t, the int16_t we want being the low half
+        __m256i v = _mm256_mask_i32gather_epi32(zero, (const int32_t *)comb_luts, at, mask, sizeof(comb_luts[0][0]));
+        v = _mm256_srai_epi32(_mm256_slli_epi32(v, 16), 16);
+        _mm256_maskstore_ps(c->neurons + i, mask, _mm256_mul_ps(_mm256_cvtepi32_ps(v), scale));
     }
-
-    for (uint64_t i = 0; i < SYNAPSES_LEN; ++i) {
-        if (frandf() < mutation_chance) {
-            c->synapses[i].src = rand64() % NEURONS_LEN;
-            c->synapses[i].dst = rand64() % NEURONS_LEN;
-            c->synapses[i].weight = frandf() * 2.f - 1.f;
-            c->color = similar_color(c->color);
-        }
+}
+#endif
+
+// update_brain_kernel in fixed point. Only the neurons of the cell are
+// floats, they can be anywhere from -1 to 1 so the int16_t ones can't
+// overflow, and neither can the sums with up to SYNAPSES_MAX synapses.
+// Integer sums don't depend on the order of the synapses, so unlike with
+// floats any version of activate_quantised gives the same neurons.
+ALWAYS_INLINE void update_brain_quantised_kernel(struct Cell *c, const struct Quantised_Synapse *q, int64_t synapses) {
+    int16_t neurons[NEURONS_LEN];
+    int32_t sums[NEURONS_LEN] = {};
+
+    for (int32_t i = 0; i < NEURONS_LEN; ++i) neurons[i] = c->neurons[i] * QUANTISED_ONE;
+
+#pragma GCC unroll 64
+    for (int32_t i = 0; i < synapses; ++i) {
+        const struct Quantised_Synapse s = q[i];
+        sums[s.dst] += neurons[s.src] * s.weight;
     }
 
-    for (uint64_t i = 0; i < NEURONS_LEN; ++i) {
-        if (frandf() < mutation_chance) {
-            c->neuron_combs[i] = rand64() % COMB_LEN;
-            c->color = similar_color(c->color);
-        }
+#ifdef __x86_64__
+    if (quantised_avx2) {
+        activate_quantised_avx2(c, sums);
+        return;
     }
+#endif
+    activate_quantised(c, sums);
 }
 
-void do_move(struct Cell *c, int8_t dx, int8_t dy) {
-    c->x = mod(c->x + dx, FIELD_W);
-    c->y = mod(c->y + dy, FIELD_H);
+void update_brain_quantised_generic(struct Cell *c) { update_brain_quantised_kernel(c, quantised_synapses_of(c), synapses_len); }
+void update_brain_quantised_8 (struct Cell *c) { update_brain_quantised_kernel(c, quantised_synapses_of(c),  8); }
+void update_brain_quantised_16(struct Cell *c) { update_brain_quantised_kernel(c, quantised_synapses_of(c), 16); }
+void update_brain_quantised_30(struct Cell *c) { update_brain_quantised_kernel(c, quantised_synapses_of(c), 30); }
+void update_brain_quantised_32(struct Cell *c) { update_brain_quantised_kernel(c, quantised_synapses_of(c), 32); }
+void update_brain_quantised_64(struct Cell *c) { update_brain_quantised_kernel(c, quantised_synapses_of(c), 64); }
+
+WORLD_LOCAL void (*set_brain_inputs)(struct Cell *c) = set_brain_inputs_generic;
+WORLD_LOCAL void (*update_brain)(struct Cell *c) = update_brain_generic;
+
+void select_kernels() {
+    const bool pow2 = !(field_w & (field_w - 1)) && !(field_h & (field_h - 1));
+    field_h_log2 = __builtin_ctzll(field_h);
+    set_brain_inputs = sparse_field ? set_brain_inputs_sparse : pow2 ? set_brain_inputs_pow2 : set_brain_inputs_generic;
+
+    if (quantised_brains) {
+        init_comb_luts();
+#ifdef __x86_64__
+        quantised_avx2 = __builtin_cpu_supports("avx2");
+#endif
+        switch (synapses_len) {
+        case  8: update_brain = update_brain_quantised_8;  break;
+        case 16: update_brain = update_brain_quantised_16; break;
+        case 30: update_brain = update_brain_quantised_30; break;
+        case 32: update_brain = update_brain_quantised_32; break;
+        case 64: update_brain = update_brain_quantised_64; break;
+        default: update_brain = update_brain_quantised_generic;
+        }
+        return;
+    }
 
-    c->dir_x = dx;
-    c->dir_y = dy;
+    switch (synapses_len) {
+    case  8: update_brain = update_brain_8;  break;
+    case 16: update_brain = update_brain_16; break;
+    case 30: update_brain = update_brain_30; break;
+    case 32: update_brain = update_brain_32; break;
+    case 64: update_brain = update_brain_64; break;
+    default: update_brain = update_brain_generic;
+    }
 }
 
-void do_mitose(struct Cell *c, int8_t dx, int8_t dy) {
-    struct Cell *new = alloc_cell(&cell_arena);
-    {
-        struct Cell *next = new->next;
-        struct Cell *prev = new->prev;
-        *new = *c;
-        new->next = next;
-        new->prev = prev;
-    }
+// The plain scalar brain kernels. Faster versions of set_brain_inputs and
+// update_brain must give the same neurons as these, which a build with
+// -DCHECK_KERNELS checks while it runs, so these must not change.
+void set_brain_inputs_reference(struct Cell *c) {
+    c->neurons[IN_BIAS] = 1.f;
 
-    mutate(new, MUTATION_CHANCE);
+    c->neurons[IN_LIKE_U] = get_in_like(c,  c->dir_x,  c->dir_y);
+    c->neurons[IN_LIKE_L] = get_in_like(c, -c->dir_y,  c->dir_x);
+    c->neurons[IN_LIKE_D] = get_in_like(c, -c->dir_x, -c->dir_y);
+    c->neurons[IN_LIKE_R] = get_in_like(c,  c->dir_x, -c->dir_x);
 
-    do_move(new, dx, dy);
-    c->dir_x = -dx;
-    c->dir_y = -dy;
+    c->neurons[IN_EATABLE_U] = get_in_eatable(c,  c->dir_x,  c->dir_y);
+    c->neurons[IN_EATABLE_L] = get_in_eatable(c, -c->dir_y,  c->dir_x);
+    c->neurons[IN_EATABLE_D] = get_in_eatable(c, -c->dir_x, -c->dir_y);
+    c->neurons[IN_EATABLE_R] = get_in_eatable(c,  c->dir_x, -c->dir_x);
 
-    new->energy *= ENERGY_MULTIPLIED_AFER_MITOSIS;
-    c  ->energy *= ENERGY_MULTIPLIED_AFER_MITOSIS;
+    c->neurons[IN_NORTH_U] = c->dir_y == -1 ? 1.f : -1.f;
+    c->neurons[IN_NORTH_L] = c->dir_x == -1 ? 1.f : -1.f;
+    c->neurons[IN_NORTH_D] = c->dir_y ==  1 ? 1.f : -1.f;
+    c->neurons[IN_NORTH_R] = c->dir_x ==  1 ? 1.f : -1.f;
 
-    place_on_field_or_die(new);
+    c->neurons[IN_ENERGY] = c->energy * 2.f - 1.f;
 }
 
-void act_based_on_brain_outputs(struct Cell *c) {
+void update_brain_reference(struct Cell *c) {
+    float new_neurons[NEURONS_LEN] = {};
+
+    for (int32_t i = 0; i < synapses_len; ++i) {
+        new_neurons[c->synapses[i].dst] += c->neurons[c->synapses[i].src] * c->synapses[i].weight;
+    }
+
+    for (int32_t i = 0; i < NEURONS_LEN; ++i) {
+        switch (c->neuron_combs[i]) {
+        case COMB_SIGMOID: c->neurons[i] = comb_sigmoid(new_neurons[i]); break;
+        case COMB_COS:     c->neurons[i] = comb_cos    (new_neurons[i]); break;
+        default: assert(false);
+        }
+    }
+}
+
+// The output neuron the cell acts on
+int32_t brain_decision(const struct Cell *c) {
     int32_t max_neuron_id = OUT_MOVE_U;
     for (int32_t i = max_neuron_id; i < NEURONS_LEN; ++i) {
         if (c->neurons[max_neuron_id] < c->neurons[i]) max_neuron_id = i;
     }
+    return max_neuron_id;
+}
+
+#ifdef CHECK_KERNELS
+// Every check_every-th update of a cell is also done with the reference
+// kernels. Neurons further apart than check_tolerance are a divergence, the
+// first one is printed with everything about the cell.
+uint64_t check_every = 1;
+float check_tolerance = 0;
+uint64_t check_updates;
+uint64_t checks;
+uint64_t divergences;
+
+const char *neuron_names[NEURONS_LEN] = {
+    "IN_BIAS", "IN_LIKE_U", "IN_LIKE_R", "IN_LIKE_D", "IN_LIKE_L",
+    "IN_EATABLE_U", "IN_EATABLE_R", "IN_EATABLE_D", "IN_EATABLE_L",
+    "IN_NORTH_U", "IN_NORTH_R", "IN_NORTH_D", "IN_NORTH_L", "IN_ENERGY",
+    "INTERNAL_A", "INTERNAL_B", "INTERNAL_C", "INTERNAL_D", "INTERNAL_E",
+    "OUT_MOVE_U", "OUT_MOVE_R", "OUT_MOVE_D", "OUT_MOVE_L",
+    "OUT_MITOSE_U", "OUT_MITOSE_R", "OUT_MITOSE_D", "OUT_MITOSE_L", "OUT_SLEEP",
+};
+
+// The first neuron further apart than the tolerance, -1 if none
+int64_t diverging_neuron(const struct Cell *reference, const struct Cell *optimised) {
+    for (int64_t i = 0; i < NEURONS_LEN; ++i) {
+        const float a = reference->neurons[i], b = optimised->neurons[i];
+        if (a == b) continue;
+        if (isnan(a) || isnan(b) || fabsf(a - b) > check_tolerance) return i;
+    }
+    return -1;
+}
+
+// input is what both kernels started from
+void print_divergence(const char *kernel, int64_t neuron, const struct Cell *c, const struct Cell *input, const struct Cell *reference, const struct Cell *optimised) {
+    eprintf("%s diverged at tick %lu on %s: reference %.9g, optimised %.9g, tolerance %g\n",
+            kernel, tick_count, neuron_names[neuron], reference->neurons[neuron], optimised->neurons[neuron], check_tolerance);
+    eprintf("cell %ld at %ld %ld facing %d %d, color %06x, energy %.9g, metabolism %.9g, %s\n",
+            slot_of(c), input->x, input->y, input->dir_x, input->dir_y,
+            input->color, input->energy, input->metabolism, input->sleeping ? "sleeping" : "awake");
+    eprintf("%-14s %-8s %16s %16s %16s\n", "neuron", "comb", "input", "reference", "optimised");
+    for (int64_t i = 0; i < NEURONS_LEN; ++i) {
+        eprintf("%-14s %-8s %16.9g %16.9g %16.9g%s\n", neuron_names[i],
+                input->neuron_combs[i] == COMB_SIGMOID ? "sigmoid" : "cos",
+                input->neurons[i], reference->neurons[i], optimised->neurons[i],
+                reference->neurons[i] != optimised->neurons[i] ? " *" : "");
+    }
+    eprintf("synapses:\n");
+    for (int64_t i = 0; i < synapses_len; ++i) {
+        eprintf("    %-14s -> %-14s %.9g\n", neuron_names[input->synapses[i].src],
+                neuron_names[input->synapses[i].dst], input->synapses[i].weight);
+    }
+}
+
+// Quantised brains only come close to the reference, what matters is how
+// often that makes a cell do something else
+uint64_t decisions_changed;
+float quantised_error;
+
+void compare_quantised(const struct Cell *reference, const struct Cell *quantised) {
+    for (int64_t i = 0; i < NEURONS_LEN; ++i) {
+        const float error = fabsf(reference->neurons[i] - quantised->neurons[i]);
+        if (error > quantised_error) quantised_error = error;
+    }
+    decisions_changed += brain_decision(reference) != brain_decision(quantised);
+}
+
+// Runs each kernel on the same input both ways, so a divergence is pinned on
+// the kernel that caused it
+void check_kernels(const struct Cell *before, struct Cell *c) {
+    ++checks;
+
+    struct Cell reference = *before, optimised = *before;
+    set_brain_inputs_reference(&reference);
+    set_brain_inputs(&optimised);
+    int64_t neuron = diverging_neuron(&reference, &optimised);
+    if (neuron >= 0) {
+        if (!divergences++) print_divergence("set_brain_inputs", neuron, c, before, &reference, &optimised);
+        return;
+    }
+
+    const struct Cell input = optimised;
+    update_brain_reference(&reference);
+    // The copy stops before the quantised synapses, so they are the cell's
+    if (quantised_brains) update_brain_quantised_kernel(&optimised, quantised_synapses_of(c), synapses_len);
+    else update_brain(&optimised);
+    if (quantised_brains) {
+        compare_quantised(&reference, &optimised);
+        neuron = -1;
+    } else {
+        neuron = diverging_neuron(&reference, &optimised);
+        if (neuron >= 0 && !divergences++) print_divergence("update_brain", neuron, c, &input, &reference, &optimised);
+    }
+    // The cell itself was updated by the optimised kernels, it should match
+    if (neuron < 0 && memcmp(optimised.neurons, c->neurons, sizeof(c->neurons))) {
+        if (!divergences++) eprintf("update of cell %ld at tick %lu is not repeatable\n", slot_of(c), tick_count);
+    }
+}
+
+void print_checks() {
+    eprintf("checked %lu cell updates, %lu diverged\n", checks, divergences);
+    if (quantised_brains && checks) {
+        eprintf("quantised brains acted otherwise in %lu of them (%.3f%%), neurons were off by up to %g\n",
+                decisions_changed, 100. * decisions_changed / checks, quantised_error);
+    }
+}
+#endif
+
+void kill_cell(struct Cell *c) {
+    if (journal) journal_death(&journal_buffer, tick_count, slot_of(c), false);
+    COUNT(starved);
+    unplace_cell(c);
+    free_cell(&cell_arena, c);
+}
+
+uint32_t similar_color(uint32_t col) {
+    uint32_t r = (rand64() & 0xf0) | 0x10;
+    uint32_t g = (rand64() & 0xf0) | 0x10;
+    uint32_t b = (rand64() & 0xf0) | 0x10;
+
+    r = (r & -r) - 1;
+    g = (g & -g) - 1;
+    b = (b & -b) - 1;
+
+    return col ^ (r << 16 | g << 8 | b);
+}
+
+// Returns how many genes mutated
+int64_t mutate(struct Cell *c, float mutation_chance) {
+    int64_t mutated = 0;
+    if (frandf() < mutation_chance) {
+        c->metabolism = frandf() + minimum_metabolism;
+        c->color = similar_color(c->color);
+        ++mutated;
+    }
+
+    for (uint64_t i = 0; i < synapses_len; ++i) {
+        if (frandf() < mutation_chance) {
+            c->synapses[i].src = rand64() % NEURONS_LEN;
+            c->synapses[i].dst = rand64() % NEURONS_LEN;
+            c->synapses[i].weight = frandf() * 2.f - 1.f;
+            c->color = similar_color(c->color);
+            ++mutated;
+        }
+    }
 
-    switch (max_neuron_id) {
+    for (uint64_t i = 0; i < NEURONS_LEN; ++i) {
+        if (frandf() < mutation_chance) {
+            c->neuron_combs[i] = rand64() % COMB_LEN;
+            c->color = similar_color(c->color);
+            ++mutated;
+        }
+    }
+    return mutated;
+}
+
+void do_move(struct Cell *c, int8_t dx, int8_t dy) {
+    if (journal) journal_move(&journal_buffer, tick_count, slot_of(c), dx, dy);
+    COUNT(moves);
+
+    c->x = wrap(c->x + dx, field_w, false);
+    c->y = wrap(c->y + dy, field_h, false);
+
+    c->dir_x = dx;
+    c->dir_y = dy;
+}
+
+void do_mitose(struct Cell *c, int8_t dx, int8_t dy) {
+    struct Cell *new = alloc_cell(&cell_arena);
+    {
+        struct Cell *next = new->next;
+        struct Cell *prev = new->prev;
+        // With the quantised synapses, if any
+        memcpy(new, c, cell_arena.stride);
+        new->next = next;
+        new->prev = prev;
+    }
+
+    PROFILE_BEGIN(PHASE_MUTATE);
+    // Otherwise the child has the genome it copied from the parent
+    const int64_t genes = mutate(new, mutation_chance);
+    if (genes) {
+        new->genome = genome_of(new);
+        if (quantised_brains) quantise_synapses(new);
+    }
+    PROFILE_END(PHASE_MUTATE);
+    species_add(new);
+    if (phylogeny) {
+        if (genes) new->lineage = phylogeny_add(phylogeny, c->lineage, tick_count, genes, new->genome);
+        else phylogeny_hold(phylogeny, new->lineage);
+    }
+    COUNT(births);
+
+    // The child is born where the parent is and then moves away
+    if (journal) journal_birth(&journal_buffer, tick_count, slot_of(new), slot_of(c), new->x, new->y, new->color);
+    do_move(new, dx, dy);
+    c->dir_x = -dx;
+    c->dir_y = -dy;
+
+    new->energy *= energy_multiplied_after_mitosis;
+    c  ->energy *= energy_multiplied_after_mitosis;
+
+    PROFILE_BEGIN(PHASE_PLACE);
+    place_on_field_or_die(new);
+    PROFILE_END(PHASE_PLACE);
+}
+
+void act_based_on_brain_outputs(struct Cell *c) {
+    switch (brain_decision(c)) {
     case OUT_MOVE_U: do_move(c,  c->dir_x,  c->dir_y); break;
     case OUT_MOVE_L: do_move(c, -c->dir_y,  c->dir_x); break;
     case OUT_MOVE_D: do_move(c, -c->dir_x, -c->dir_y); break;
@@ -387,7 +1573,10 @@ void act_based_on_brain_outputs(struct Cell *c) {
     case OUT_MITOSE_D: do_mitose(c, -c->dir_x, -c->dir_y); break;
     case OUT_MITOSE_R: do_mitose(c,  c->dir_y, -c->dir_x); break;
 
-    case OUT_SLEEP: c->sleeping = true; break;
+    case OUT_SLEEP:
+        c->sleeping = true;
+        COUNT(sleeps);
+        break;
     }
 }
 
@@ -396,7 +1585,14 @@ struct Cell *update_cell(struct Cell *c) {
         c->energy += c->metabolism;
         if (c->energy >= 1.f) {
             c->energy = 1.f;
+            // The cell changes its colour while on the field
+            if (!sparse_field) add_to_mip(c, -1);
             c->sleeping = false;
+            if (!sparse_field) {
+                add_to_mip(c, 1);
+                pixels[c->y * field_w + c->x] = cell_pixel(c);
+            }
+            COUNT(wakes);
         } else {
             return c->next;
         }
@@ -410,28 +1606,757 @@ struct Cell *update_cell(struct Cell *c) {
         return next;
     }
 
-    field[c->x][c->y] = NULL;
+    unplace_cell(c);
+
+#ifdef CHECK_KERNELS
+    const bool checking = ++check_updates % check_every == 0;
+    struct Cell before;
+    if (checking) memcpy(&before, c, offsetof(struct Cell, synapses) + synapses_len * sizeof(c->synapses[0]));
+#endif
 
+    PROFILE_BEGIN(PHASE_SET_BRAIN_INPUTS);
     set_brain_inputs(c);
+    PROFILE_END(PHASE_SET_BRAIN_INPUTS);
+
+    PROFILE_BEGIN(PHASE_UPDATE_BRAIN);
     update_brain(c);
+    PROFILE_END(PHASE_UPDATE_BRAIN);
+
+#ifdef CHECK_KERNELS
+    if (checking) check_kernels(&before, c);
+#endif
+
+    PROFILE_BEGIN(PHASE_ACT);
     act_based_on_brain_outputs(c);
+    PROFILE_END(PHASE_ACT);
 
     struct Cell *next = c->next;
-    if (place_on_field_or_die(c)) return next;
-    return c->next;
+    PROFILE_BEGIN(PHASE_PLACE);
+    const bool dead = place_on_field_or_die(c);
+    PROFILE_END(PHASE_PLACE);
+    return dead ? next : c->next;
 }
 
-void do_tick() {
-    static struct Cell *cur;
+#define TELEMETRY_CSV_HEADER "tick,population,sleeping,mean_energy,mean_metabolism,spawns,births,starved,eaten,moves,sleeps,wakes,species\n"
+
+// Prints a line of CSV with the counts since prev and makes prev the current
+// counts
+void print_telemetry(FILE *f, struct Telemetry_Counters *prev) {
+    uint64_t sleeping = 0;
+    double energy = 0, metabolism = 0;
+    for (struct Cell *it = cell_arena.head; it; it = it->next) {
+        sleeping += it->sleeping;
+        energy += it->energy;
+        metabolism += it->metabolism;
+    }
+    const int64_t population = cell_arena.len;
+
+    const struct Telemetry_Counters *c = &telemetry_counters;
+    fprintf(f, "%lu,%ld,%lu,%.4f,%.4f,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%ld\n",
+            tick_count, population, sleeping,
+            population ? energy / population : 0, population ? metabolism / population : 0,
+            c->spawns - prev->spawns, c->births - prev->births, c->starved - prev->starved,
+            c->eaten - prev->eaten, c->moves - prev->moves, c->sleeps - prev->sleeps, c->wakes - prev->wakes,
+            arr_len(species_list));
+    *prev = *c;
+}
 
-    if (!cur) {
+void do_tick() {
+    if (!tick_cursor) {
         create_random_cell();
-        cur = cell_arena.head;
+        tick_cursor = cell_arena.head;
+    }
+#ifdef PROFILE
+    profile_weight = tick_count % PROFILE_SAMPLE_TICKS ? 0 : PROFILE_SAMPLE_TICKS;
+#endif
+    tick_cursor = update_cell(tick_cursor);
+#ifdef PROFILE
+    profile_weight = 1;
+#endif
+    ++tick_count;
+
+#ifndef NO_TELEMETRY
+    if (telemetry_file && tick_count >= telemetry_next_tick) {
+        static struct Telemetry_Counters prev;
+        print_telemetry(telemetry_file, &prev);
+        telemetry_next_tick = tick_count + telemetry_interval;
+    }
+#endif
+}
+
+// A checkpoint is a header followed by the cells in list order, so the links
+// between them need not be stored and the field is rebuilt from positions.
+// Everything has a fixed size and layout, so restoring is just copying out of
+// the mapped file. Checkpoints are only valid for the same field size and
+// brain shape and for machines with the same endianness.
+#define CHECKPOINT_MAGIC "ECOCKPT"
+#define CHECKPOINT_VERSION 2
+
+struct Checkpoint_Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t cell_record_size;
+    int64_t field_w;
+    int64_t field_h;
+    int64_t neurons_len;
+    int64_t synapses_len;
+    // The rest of what decides how the world goes on
+    float mutation_chance;
+    float minimum_metabolism;
+    float energy_multiplied_after_mitosis;
+    uint32_t quantised_brains;
+    uint64_t tick_count;
+    uint64_t rng[3];
+    int64_t cells_len;
+    int64_t cursor; // Index of tick_cursor, -1 when NULL
+};
+
+struct Cell_Record {
+    int32_t x;
+    int32_t y;
+    int8_t dir_x;
+    int8_t dir_y;
+    uint8_t sleeping;
+    uint8_t pad;
+    uint32_t color;
+    float energy;
+    float metabolism;
+    float neurons[NEURONS_LEN];
+    uint8_t neuron_combs[NEURONS_LEN];
+    struct {
+        uint8_t src;
+        uint8_t dst;
+        uint8_t pad[2];
+        float weight;
+    } synapses[SYNAPSES_MAX];
+};
+
+// Only the first synapses_len synapses are written, so with the default 30 the
+// records are the same as before the count could be changed
+int64_t cell_record_size() {
+    return offsetof(struct Cell_Record, synapses) + synapses_len * sizeof(((struct Cell_Record*)0)->synapses[0]);
+}
+
+void cell_to_record(const struct Cell *c, struct Cell_Record *r) {
+    memset(r, 0, sizeof(*r));
+    r->x = c->x;
+    r->y = c->y;
+    r->dir_x = c->dir_x;
+    r->dir_y = c->dir_y;
+    r->sleeping = c->sleeping;
+    r->color = c->color;
+    r->energy = c->energy;
+    r->metabolism = c->metabolism;
+    for (int64_t i = 0; i < NEURONS_LEN; ++i) {
+        r->neurons[i] = c->neurons[i];
+        r->neuron_combs[i] = c->neuron_combs[i];
+    }
+    for (int64_t i = 0; i < synapses_len; ++i) {
+        r->synapses[i].src = c->synapses[i].src;
+        r->synapses[i].dst = c->synapses[i].dst;
+        r->synapses[i].weight = c->synapses[i].weight;
+    }
+}
+
+void cell_from_record(struct Cell *c, const struct Cell_Record *r) {
+    c->x = r->x;
+    c->y = r->y;
+    c->dir_x = r->dir_x;
+    c->dir_y = r->dir_y;
+    c->sleeping = r->sleeping;
+    c->color = r->color;
+    c->energy = r->energy;
+    c->metabolism = r->metabolism;
+    for (int64_t i = 0; i < NEURONS_LEN; ++i) {
+        c->neurons[i] = r->neurons[i];
+        c->neuron_combs[i] = r->neuron_combs[i];
+    }
+    for (int64_t i = 0; i < synapses_len; ++i) {
+        c->synapses[i].src = r->synapses[i].src;
+        c->synapses[i].dst = r->synapses[i].dst;
+        c->synapses[i].weight = r->synapses[i].weight;
+    }
+    c->genome = genome_of(c);
+    if (quantised_brains) quantise_synapses(c);
+    c->lineage = -1;
+}
+
+// Whether a record read from a file can be made a cell without indexing
+// anything out of bounds
+bool cell_record_valid(const struct Cell_Record *r) {
+    if (r->x < 0 || r->x >= field_w || r->y < 0 || r->y >= field_h) return false;
+    if (r->dir_x < -1 || r->dir_x > 1 || r->dir_y < -1 || r->dir_y > 1) return false;
+    for (int64_t i = 0; i < NEURONS_LEN; ++i) {
+        if (r->neuron_combs[i] >= COMB_LEN) return false;
+    }
+    for (int64_t i = 0; i < synapses_len; ++i) {
+        if (r->synapses[i].src >= NEURONS_LEN || r->synapses[i].dst >= NEURONS_LEN) return false;
+    }
+    return true;
+}
+
+int compare_positions(const void *a, const void *b) {
+    const int64_t x = *(int64_t*)a, y = *(int64_t*)b;
+    return (x > y) - (x < y);
+}
+
+// Written to a temporary file first so a crash never leaves half a checkpoint
+bool save_checkpoint(const char *path) {
+    char tmp_path[4096];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+    FILE *f = fopen(tmp_path, "wb");
+    if (!f) {
+        eprintf("Could not open %s\n", tmp_path);
+        return false;
+    }
+
+    struct Checkpoint_Header h = {
+        .magic = CHECKPOINT_MAGIC,
+        .version = CHECKPOINT_VERSION,
+        .cell_record_size = cell_record_size(),
+        .field_w = field_w,
+        .field_h = field_h,
+        .neurons_len = NEURONS_LEN,
+        .synapses_len = synapses_len,
+        .mutation_chance = mutation_chance,
+        .minimum_metabolism = minimum_metabolism,
+        .energy_multiplied_after_mitosis = energy_multiplied_after_mitosis,
+        .quantised_brains = quantised_brains,
+        .tick_count = tick_count,
+        .rng = { xorshf_x, xorshf_y, xorshf_z },
+        .cells_len = 0,
+        .cursor = -1,
+    };
+    for (struct Cell *it = cell_arena.head; it; it = it->next) {
+        if (it == tick_cursor) h.cursor = h.cells_len;
+        ++h.cells_len;
+    }
+
+    bool ok = fwrite(&h, sizeof(h), 1, f) == 1;
+    struct Cell_Record r;
+    for (struct Cell *it = cell_arena.head; ok && it; it = it->next) {
+        cell_to_record(it, &r);
+        ok = fwrite(&r, cell_record_size(), 1, f) == 1;
+    }
+
+    ok &= fflush(f) == 0 && fsync(fileno(f)) == 0;
+    ok &= fclose(f) == 0;
+    if (!ok || rename(tmp_path, path)) {
+        eprintf("Could not write %s\n", path);
+        unlink(tmp_path);
+        return false;
+    }
+    return true;
+}
+
+bool load_checkpoint(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        eprintf("Could not open %s\n", path);
+        return false;
+    }
+
+    struct stat st;
+    void *data = MAP_FAILED;
+    if (!fstat(fd, &st) && st.st_size >= sizeof(struct Checkpoint_Header))
+        data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        eprintf("Could not map %s\n", path);
+        return false;
+    }
+
+    const struct Checkpoint_Header *h = data;
+    const uint8_t *records = (void*)(h + 1);
+    if (memcmp(h->magic, CHECKPOINT_MAGIC, sizeof(h->magic)) ||
+        h->version != CHECKPOINT_VERSION ||
+        h->neurons_len != NEURONS_LEN ||
+        h->synapses_len < 0 || h->synapses_len > SYNAPSES_MAX ||
+        h->cell_record_size != offsetof(struct Cell_Record, synapses) + h->synapses_len * sizeof(((struct Cell_Record*)0)->synapses[0]) ||
+        h->cells_len < 0 || h->cursor < -1 || h->cursor >= h->cells_len ||
+        st.st_size != sizeof(*h) + h->cells_len * h->cell_record_size) {
+        eprintf("%s is not a compatible checkpoint\n", path);
+        munmap(data, st.st_size);
+        return false;
+    }
+    if (h->field_w != field_w || h->field_h != field_h || h->synapses_len != synapses_len) {
+        eprintf("%s is of a %ldx%ld field with %ld synapses, run with -g %ldx%ld -l %ld\n",
+                path, h->field_w, h->field_h, h->synapses_len, h->field_w, h->field_h, h->synapses_len);
+        munmap(data, st.st_size);
+        return false;
+    }
+    // Going on with other parameters would quietly be another run
+    if (h->mutation_chance != mutation_chance || h->minimum_metabolism != minimum_metabolism ||
+        h->energy_multiplied_after_mitosis != energy_multiplied_after_mitosis || h->quantised_brains != quantised_brains) {
+        eprintf("%s was saved with other parameters, run with -u %g -b %g -E %g%s\n",
+                path, h->mutation_chance, h->minimum_metabolism, h->energy_multiplied_after_mitosis, h->quantised_brains ? " -q" : "");
+        munmap(data, st.st_size);
+        return false;
+    }
+    if (h->cells_len > cell_arena.cap_max) {
+        eprintf("%s has more cells than fit on the field\n", path);
+        munmap(data, st.st_size);
+        return false;
+    }
+
+    // Every record is checked before the world is touched, so a corrupt
+    // checkpoint leaves it as it was
+    int64_t *positions = malloc(sizeof(*positions) * (h->cells_len + 1));
+    bool valid = true;
+    for (int64_t i = 0; valid && i < h->cells_len; ++i) {
+        struct Cell_Record r;
+        memcpy(&r, records + i * h->cell_record_size, h->cell_record_size);
+        valid = cell_record_valid(&r);
+        positions[i] = (int64_t)r.x * field_h + r.y;
+    }
+    if (valid) {
+        qsort(positions, h->cells_len, sizeof(*positions), compare_positions);
+        for (int64_t i = 1; valid && i < h->cells_len; ++i) valid = positions[i] != positions[i - 1];
+    }
+    free(positions);
+    if (!valid) {
+        eprintf("%s is corrupt, it has cells off the field, on top of each other or with broken brains\n", path);
+        munmap(data, st.st_size);
+        return false;
+    }
+
+    if (sparse_field) {
+        clear_tiles();
+    } else {
+        memset(field, 0, field_w * field_h * sizeof(*field));
+        clear_occupancy();
+        memset(pixels, 0, field_w * field_h * sizeof(*pixels));
+        for (int64_t l = 0; l < MIP_LEVELS; ++l) memset(mip[l], 0, mip_w[l] * mip_h[l] * sizeof(*mip[l]));
+    }
+
+    // The lineages of the cells we had end here, those of the checkpoint
+    // start over as roots
+    struct Cell_Arena *ca = &cell_arena;
+    if (phylogeny) for (struct Cell *c = ca->head; c; c = c->next) phylogeny_release(phylogeny, c->lineage, tick_count);
+
+    // The cells take the first slots of the arena in list order
+    while (ca->cap < h->cells_len && grow_cell_arena(ca)) {}
+    ca->top = h->cells_len;
+    ca->free_len = 0;
+    // Checkpoints don't say when species appeared, they all start here
+    tick_count = h->tick_count;
+    clear_species();
+    for (int64_t i = 0; i < h->cells_len; ++i) {
+        struct Cell *c = cell_in_slot(ca, i);
+        struct Cell_Record r;
+        memcpy(&r, records + i * h->cell_record_size, h->cell_record_size);
+        cell_from_record(c, &r);
+        c->prev = i > 0 ? cell_in_slot(ca, i - 1) : NULL;
+        c->next = i + 1 < h->cells_len ? cell_in_slot(ca, i + 1) : NULL;
+        place_cell(c);
+        species_add(c);
+        if (phylogeny) c->lineage = phylogeny_add(phylogeny, -1, tick_count, 0, c->genome);
+    }
+    ca->len = h->cells_len;
+    ca->head = h->cells_len ? cell_in_slot(ca, 0) : NULL;
+
+    // The slots mean other cells from here on
+    if (journal) {
+        journal_reset(&journal_buffer, tick_count);
+        for (struct Cell *c = ca->head; c; c = c->next) {
+            journal_birth(&journal_buffer, tick_count, slot_of(c), -1, c->x, c->y, c->color);
+        }
+    }
+
+    tick_cursor = h->cursor >= 0 ? cell_in_slot(ca, h->cursor) : NULL;
+    xorshf_x = h->rng[0];
+    xorshf_y = h->rng[1];
+    xorshf_z = h->rng[2];
+
+    munmap(data, st.st_size);
+    return true;
+}
+
+// FNV-1a of everything a checkpoint would hold. Equal hashes after the same
+// ticks from the same start mean the runs went exactly the same way.
+uint64_t hash_bytes(uint64_t h, const void *data, size_t len) {
+    const uint8_t *p = data;
+    for (size_t i = 0; i < len; ++i) h = (h ^ p[i]) * 0x100000001b3;
+    return h;
+}
+
+uint64_t hash_world() {
+    uint64_t h = 0xcbf29ce484222325;
+    const uint64_t state[] = { field_w, field_h, tick_count, xorshf_x, xorshf_y, xorshf_z };
+    h = hash_bytes(h, state, sizeof(state));
+
+    int64_t i = 0, cursor = -1;
+    for (struct Cell *it = cell_arena.head; it; it = it->next, ++i) {
+        struct Cell_Record r;
+        cell_to_record(it, &r);
+        h = hash_bytes(h, &r, cell_record_size());
+        if (it == tick_cursor) cursor = i;
+    }
+    return hash_bytes(h, &cursor, sizeof(cursor));
+}
+
+void checkpoint_dir_path(char *path, size_t len, uint64_t tick) {
+    snprintf(path, len, "%s/eco-%020lu.ckpt", checkpoint_dir, tick);
+}
+
+int compare_ticks(const void *a, const void *b) {
+    const uint64_t x = *(uint64_t*)a, y = *(uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+// The ticks of the checkpoints in checkpoint_dir, oldest first
+uint64_t *list_checkpoints() {
+    uint64_t *ticks = arr_create(uint64_t);
+
+    DIR *dir = opendir(checkpoint_dir);
+    if (!dir) return ticks;
+    for (struct dirent *e; (e = readdir(dir));) {
+        uint64_t tick;
+        char rest;
+        if (sscanf(e->d_name, "eco-%lu.ckp%c", &tick, &rest) == 2 && rest == 't' && strlen(e->d_name) == 29)
+            arr_push(&ticks, tick);
+    }
+    closedir(dir);
+
+    qsort(ticks, arr_len(ticks), sizeof(*ticks), compare_ticks);
+    return ticks;
+}
+
+void prune_checkpoints() {
+    if (checkpoint_retention <= 0) return;
+
+    uint64_t *ticks = list_checkpoints();
+    for (int64_t i = 0; i < arr_len(ticks) - checkpoint_retention; ++i) {
+        char path[4096];
+        checkpoint_dir_path(path, sizeof(path), ticks[i]);
+        unlink(path);
+    }
+    arr_free(ticks);
+}
+
+void start_background_checkpoint() {
+    const uint64_t start_ts = get_timestamp();
+    const pid_t pid = fork();
+    if (pid == 0) {
+        char path[4096];
+        checkpoint_dir_path(path, sizeof(path), tick_count);
+        _exit(save_checkpoint(path) ? 0 : 1);
+    }
+
+    checkpoint_stall_ns = get_timestamp() - start_ts;
+    if (checkpoint_stall_ns > checkpoint_max_stall_ns) checkpoint_max_stall_ns = checkpoint_stall_ns;
+    checkpoint_last_ts = start_ts;
+    checkpoint_last_tick = tick_count;
+
+    if (pid < 0) {
+        eprintf("Could not fork for a checkpoint\n");
+        return;
+    }
+    checkpoint_pid = pid;
+    checkpoint_pid_tick = tick_count;
+}
+
+// Returns false if the child writing a checkpoint isn't done, waiting for it
+// when told to
+bool reap_background_checkpoint(bool wait) {
+    if (!checkpoint_pid) return true;
+
+    int status;
+    if (waitpid(checkpoint_pid, &status, wait ? 0 : WNOHANG) != checkpoint_pid) return false;
+    checkpoint_pid = 0;
+
+    if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+        printf("checkpoint of tick %lu written, stalled %.2f ms (max %.2f ms)\n",
+               checkpoint_pid_tick, checkpoint_stall_ns / 1e6, checkpoint_max_stall_ns / 1e6);
+        prune_checkpoints();
+    } else {
+        eprintf("Checkpoint of tick %lu failed\n", checkpoint_pid_tick);
+    }
+    return true;
+}
+
+// So the last checkpoint isn't cut off when we exit
+void finish_background_checkpoint() {
+    reap_background_checkpoint(true);
+}
+
+void poll_background_checkpoint() {
+    if (!checkpoint_dir || replaying) return;
+    if (!reap_background_checkpoint(false)) return;
+
+    const uint64_t cur_ts = get_timestamp();
+    if (!checkpoint_last_ts) {
+        checkpoint_last_ts = cur_ts;
+        checkpoint_last_tick = tick_count;
+    }
+    if (checkpoint_interval_ticks ? tick_count - checkpoint_last_tick >= checkpoint_interval_ticks
+                                  : cur_ts - checkpoint_last_ts >= checkpoint_interval_seconds * 1e9)
+        start_background_checkpoint();
+}
+
+// Seeks to a tick of the run in checkpoint_dir. Runs are deterministic, so
+// we restore the newest checkpoint at or before it and tick forward from
+// there, in a single frame that may go over tick_budget_seconds. How long
+// that takes depends on how far apart the checkpoints are, hence -t.
+bool seek(uint64_t target) {
+    uint64_t *ticks = list_checkpoints();
+    if (!arr_len(ticks)) {
+        eprintf("There are no checkpoints in %s\n", checkpoint_dir);
+        arr_free(ticks);
+        return false;
+    }
+
+    if (target < ticks[0]) target = ticks[0];
+    uint64_t keyframe = ticks[0];
+    for (int64_t i = 0; i < arr_len(ticks) && ticks[i] <= target; ++i) keyframe = ticks[i];
+    arr_free(ticks);
+
+    // Ticking on from where we are is faster if we are past the keyframe
+    if (target < tick_count || keyframe > tick_count) {
+        char path[4096];
+        checkpoint_dir_path(path, sizeof(path), keyframe);
+        if (!load_checkpoint(path)) return false;
+    }
+
+    seek_tick = target;
+    printf("seeking to tick %lu from %lu\n", seek_tick, tick_count);
+    return true;
+}
+
+void close_journal() {
+    if (!journal) return;
+    journal_close(journal, &journal_buffer, 1);
+    printf("journal: %lu bytes, waited for the disk %lu times\n", journal->bytes_written, journal->waits);
+    free(journal);
+    journal = NULL;
+}
+
+void open_journal() {
+    journal = journal_open(journal_path, field_w, field_h);
+    if (!journal) {
+        eprintf("Could not open %s\n", journal_path);
+        exit(-1);
+    }
+    journal_init_buffer(&journal_buffer, journal, 0, tick_count);
+    atexit(close_journal);
+}
+
+void close_phylogeny() {
+    if (!phylogeny) return;
+    printf("phylogeny: %lu nodes, %lu bytes, at most %ld nodes in memory\n", phylogeny->next_id, phylogeny->bytes_written, phylogeny->peak_len);
+    phylogeny_close(phylogeny);
+    phylogeny = NULL;
+}
+
+// The cells we already have are the roots
+void open_phylogeny() {
+    phylogeny = phylogeny_open(phylogeny_path, tick_count);
+    if (!phylogeny) {
+        eprintf("Could not open %s\n", phylogeny_path);
+        exit(-1);
+    }
+    for (struct Cell *c = cell_arena.head; c; c = c->next) {
+        c->lineage = phylogeny_add(phylogeny, -1, tick_count, 0, c->genome);
+    }
+    atexit(close_phylogeny);
+}
+
+void close_exporter() {
+    if (!exporter) return;
+    const uint64_t skipped = exporter->frames_skipped;
+    video_close(exporter);
+    eprintf("export: %lu frames skipped\n", skipped);
+    exporter = NULL;
+}
+
+void open_exporter() {
+    if (export_fps) exporter = video_open(export_path, export_format, field_w, field_h, export_fps, 1);
+    else exporter = video_open(export_path, export_format, field_w, field_h, 60, export_every);
+    if (!exporter) {
+        eprintf("Could not open %s\n", export_path);
+        exit(-1);
+    }
+    atexit(close_exporter);
+}
+
+void export_frame() {
+    static uint64_t frame;
+    if (frame++ % export_every) return;
+
+    // Skip the frame rather than wait when the writer can't keep up
+    uint8_t *rgb = video_begin_frame(exporter);
+    if (!rgb) return;
+
+    memset(rgb, 0xff, 3 * field_w * field_h);
+    for (struct Cell *it = cell_arena.head; it; it = it->next) {
+        const uint32_t color = cell_draw_color(it);
+        uint8_t *p = rgb + 3 * (it->y * field_w + it->x);
+        p[0] = color >> 16 & 0xff;
+        p[1] = color >>  8 & 0xff;
+        p[2] = color       & 0xff;
+    }
+
+    video_end_frame(exporter);
+}
+
+void close_recorder() {
+    if (!recorder) return;
+    recording_close(recorder);
+    eprintf("recording: %lu frames in %lu bytes\n", recorder->frames_written, recorder->bytes_written);
+    free(recorder);
+    recorder = NULL;
+}
+
+void open_recorder() {
+    recorder = recording_open(record_path, field_w, field_h, record_keyframe_interval);
+    if (!recorder) {
+        eprintf("Could not open %s\n", record_path);
+        exit(-1);
+    }
+    atexit(close_recorder);
+}
+
+void record_frame() {
+    uint32_t *pixels = recording_begin_frame(recorder);
+    memset(pixels, 0, sizeof(*pixels) * field_w * field_h);
+    for (struct Cell *it = cell_arena.head; it; it = it->next) {
+        pixels[it->y * field_w + it->x] = RECORDING_PIXEL(it->color, it->sleeping);
+    }
+    recording_end_frame(recorder, tick_count);
+}
+
+void close_telemetry() {
+    if (telemetry_file) fclose(telemetry_file);
+    telemetry_file = NULL;
+}
+
+void open_telemetry() {
+#ifdef NO_TELEMETRY
+    eprintf("Built without telemetry\n");
+    exit(-1);
+#endif
+    telemetry_file = fopen(telemetry_path, "w");
+    if (!telemetry_file) {
+        eprintf("Could not open %s\n", telemetry_path);
+        exit(-1);
+    }
+    fprintf(telemetry_file, TELEMETRY_CSV_HEADER);
+    telemetry_next_tick = tick_count + telemetry_interval;
+    atexit(close_telemetry);
+}
+
+// Everything sized by the world parameters, after they are parsed
+void init_world() {
+    // Add ten cells of breathing space
+    const int64_t cells = field_w * field_h + 10;
+    if (sparse_field) {
+        const int64_t cap_max = cells < SPARSE_CELLS_MAX ? cells : SPARSE_CELLS_MAX;
+        int64_t cap = initial_cells_len * SPARSE_ROOM_PER_CELL;
+        if (cap < SPARSE_CHUNK_MIN) cap = SPARSE_CHUNK_MIN;
+        init_cell_arena(&cell_arena, cap < cap_max ? cap : cap_max, cap_max);
+        init_tiles();
+        field = NULL;
+        occupancy = NULL;
+        memset(occupancy_counts, 0, sizeof(occupancy_counts));
+        pixels = NULL;
+        memset(mip, 0, sizeof(mip));
+    } else {
+        init_cell_arena(&cell_arena, cells, cells);
+        field = reserve(field_w * field_h * sizeof(*field));
+        init_occupancy();
+        pixels = reserve(field_w * field_h * sizeof(*pixels));
+        init_mip();
+        tile_pages = NULL;
+    }
+    init_species();
+    select_kernels();
+}
+
+void deinit_world() {
+    deinit_cell_arena(&cell_arena);
+    deinit_species();
+    if (sparse_field) {
+        deinit_tiles();
+        return;
+    }
+    unreserve(field, field_w * field_h * sizeof(*field));
+    deinit_occupancy();
+    unreserve(pixels, field_w * field_h * sizeof(*pixels));
+    for (int64_t l = 0; l < MIP_LEVELS; ++l) free(mip[l]);
+}
+
+// Everything a world is made of. Several worlds can take turns in one process
+// by saving these globals after running one and loading the next one's.
+#define WORLD_STATE(X) \
+    X(field_w) X(field_h) X(initial_cells_len) X(synapses_len) X(mutation_chance) \
+    X(minimum_metabolism) X(energy_multiplied_after_mitosis) X(field) X(occupancy) X(occupancy_counts) X(pixels) X(mip) X(mip_w) X(mip_h) \
+    X(sparse_field) X(tile_pages) X(pages_w) X(pages_h) X(tiles_len) X(spare_tiles) X(spare_tiles_len) \
+    X(species_table) X(species_table_cap) X(species_list) X(cell_arena) X(tick_cursor) X(tick_count) X(xorshf_x) X(xorshf_y) X(xorshf_z) \
+    X(telemetry_counters) X(field_h_log2) X(set_brain_inputs) X(update_brain) X(quantised_brains) X(quantised_avx2)
+
+struct World_State {
+#define X(name) __typeof__(name) name;
+    WORLD_STATE(X)
+#undef X
+};
+
+void save_world_state(struct World_State *s) {
+#define X(name) memcpy(&s->name, &name, sizeof(name));
+    WORLD_STATE(X)
+#undef X
+}
+
+void load_world_state(const struct World_State *s) {
+#define X(name) memcpy(&name, &s->name, sizeof(name));
+    WORLD_STATE(X)
+#undef X
+}
+
+#ifndef ECO_LIBRARY
+void init() {
+#ifdef PROFILE
+    profile_start();
+    atexit(print_profile);
+#endif
+#ifdef CHECK_KERNELS
+    atexit(print_checks);
+#endif
+
+    init_world();
+
+    if (export_path) open_exporter();
+    if (record_path) open_recorder();
+
+    if (replaying) {
+        if (!seek(0)) exit(-1);
+        if (phylogeny_path) open_phylogeny();
+        if (telemetry_path) open_telemetry();
+        return;
+    }
+
+    if (restore_path) {
+        if (!load_checkpoint(restore_path)) exit(-1);
+        printf("restored tick %lu from %s\n", tick_count, restore_path);
+        if (journal_path) open_journal();
+        if (phylogeny_path) open_phylogeny();
+        if (telemetry_path) open_telemetry();
+        return;
+    }
+
+    if (journal_path) open_journal();
+    if (phylogeny_path) open_phylogeny();
+    if (telemetry_path) open_telemetry();
+    srand64(get_timestamp());
+
+    for (int64_t i = 0; i < initial_cells_len; ++i) {
+        create_random_cell(&cell_arena);
     }
-    cur = update_cell(cur);
 }
 
 void update() {
+    poll_background_checkpoint();
+
     static uint64_t prev_ts;
     if (!prev_ts) prev_ts = get_timestamp();
     float dt;
@@ -441,32 +2366,174 @@ void update() {
         prev_ts = cur_ts;
     }
 
-    seconds_since_last_tick += dt;
+    // A seek is done as fast as possible, the frame waits for it
+    const bool seeking = seek_tick > tick_count;
+    const uint64_t deadline_ts = seeking ? UINT64_MAX : prev_ts + tick_budget_seconds * 1000000000;
+    uint64_t ticks = UINT64_MAX;
+    if (seeking) {
+        ticks = seek_tick - tick_count;
+        seconds_since_last_tick = 0;
+    } else if (paused) {
+        ticks = 0;
+        seconds_since_last_tick = 0;
+    } else if (!as_fast_as_possible) {
+        seconds_since_last_tick += dt;
+        ticks = seconds_since_last_tick * ticks_per_second;
+        seconds_since_last_tick -= ticks / ticks_per_second;
+    }
 
-    while (seconds_since_last_tick > 1/ticks_per_second) {
-        do_tick();
-        seconds_since_last_tick -= 1/ticks_per_second;
+    // Looking at the clock after every tick would cost more than the tick
+    uint64_t done = 0;
+    while (done < ticks) {
+        uint64_t batch = ticks - done < 256 ? ticks - done : 256;
+        for (uint64_t i = 0; i < batch; ++i) do_tick();
+        done += batch;
+        if (get_timestamp() > deadline_ts) break;
     }
-}
 
-void draw() {
-    {
-        float min_scale = fminf(window_w / FIELD_W, window_h / FIELD_H);
-        scale(min_scale, min_scale);
+    // Out of budget. The missed ticks are dropped, otherwise every following
+    // frame would try to catch up and fall even further behind.
+    if (done < ticks) seconds_since_last_tick = 0;
+
+    if (seeking && seek_tick == tick_count) printf("at tick %lu\n", tick_count);
+
+    static uint64_t report_ts, report_ticks;
+    static bool fell_behind;
+    if (!report_ts) report_ts = prev_ts;
+    report_ticks += done;
+    fell_behind |= done < ticks && !as_fast_as_possible && !seeking;
+    if (prev_ts - report_ts >= 1000000000) {
+        if (as_fast_as_possible || fell_behind) {
+            printf("%.0f tps achieved\n", report_ticks / ((prev_ts - report_ts) / 1000000000.f));
+        }
+        report_ts = prev_ts;
+        report_ticks = 0;
+        fell_behind = false;
     }
+}
 
-    uint8_t buf[FIELD_W * FIELD_H * 4];
-    memset(buf, 0xff, FIELD_W * FIELD_H * 4);
+// The field point in the middle of the window and how many pixels a cell
+// takes. A zoom of 0 means fit the whole field in the window, which also
+// centres the view.
+float view_x;
+float view_y;
+float view_zoom = 0;
+bool view_dragging;
+float view_drag_x, view_drag_y;
+
+bool clamp_view();
+
+void zoom_view_at(float factor, float at_x, float at_y) {
+    if (!clamp_view()) return;
+    const float fx = view_x + (at_x - window_w / 2) / view_zoom;
+    const float fy = view_y + (at_y - window_h / 2) / view_zoom;
+    view_zoom *= factor;
+    view_x = fx - (at_x - window_w / 2) / view_zoom;
+    view_y = fy - (at_y - window_h / 2) / view_zoom;
+}
 
-    for (struct Cell *it = cell_arena.head; it; it = it->next) {
-        uint32_t color = it->sleeping ? 0x808080 : it->color;
+// Pans by a fraction of the window
+void pan_view(float dx, float dy) {
+    if (!clamp_view()) return;
+    view_x += dx * window_w / view_zoom;
+    view_y += dy * window_h / view_zoom;
+}
+
+// False while there is no window to fit the view in
+bool clamp_view() {
+    if (window_w <= 0 || window_h <= 0) return false;
+
+    const float fit_zoom = fminf(window_w / field_w, window_h / field_h);
+    if (view_zoom < fit_zoom) view_zoom = fit_zoom;
+    if (view_zoom > 64.f) view_zoom = 64.f;
+
+    const float half_w = window_w / 2 / view_zoom;
+    const float half_h = window_h / 2 / view_zoom;
+    view_x = half_w * 2 >= field_w ? field_w / 2.f : fmaxf(half_w, fminf(field_w - half_w, view_x));
+    view_y = half_h * 2 >= field_h ? field_h / 2.f : fmaxf(half_h, fminf(field_h - half_h, view_y));
+    return true;
+}
+
+void set_view_pixel(uint8_t *p, uint32_t color) {
+    p[0] = color >> 16 & 0xff;
+    p[1] = color >>  8 & 0xff;
+    p[2] = color       & 0xff;
+}
 
-        buf[4 * (it->y * FIELD_W + it->x) + 0] = color >> 16 & 0xff;
-        buf[4 * (it->y * FIELD_W + it->x) + 1] = color >>  8 & 0xff;
-        buf[4 * (it->y * FIELD_W + it->x) + 2] = color       & 0xff;
+void draw_field() {
+    if (!clamp_view()) return;
+    if (view_dragging) {
+        view_x -= (mouse_x - view_drag_x) / view_zoom;
+        view_y -= (mouse_y - view_drag_y) / view_zoom;
+        view_drag_x = mouse_x;
+        view_drag_y = mouse_y;
     }
+    clamp_view();
+
+    // Pick the level where a block is about the size of a pixel
+    int64_t level = 0;
+    while (level < MIP_LEVELS && (2 << level) * view_zoom <= 1.f) ++level;
+
+    // Only the visible blocks are rasterised
+    const int64_t x1 = fmaxf(0, floorf(view_x - window_w / 2 / view_zoom));
+    const int64_t y1 = fmaxf(0, floorf(view_y - window_h / 2 / view_zoom));
+    const int64_t x2 = fminf(field_w, ceilf(view_x + window_w / 2 / view_zoom));
+    const int64_t y2 = fminf(field_h, ceilf(view_y + window_h / 2 / view_zoom));
+    const int64_t bx1 = x1 >> level, by1 = y1 >> level;
+    const int64_t bw = ((x2 + (1 << level) - 1) >> level) - bx1;
+    const int64_t bh = ((y2 + (1 << level) - 1) >> level) - by1;
+    if (bw <= 0 || bh <= 0) return;
+
+    static uint8_t *buf;
+    static int64_t buf_cap;
+    if (buf_cap < bw * bh * 4) {
+        buf_cap = bw * bh * 4;
+        buf = realloc(buf, buf_cap);
+    }
+
+    if (level == 0) {
+        for (int64_t y = 0; y < bh; ++y) {
+            for (int64_t x = 0; x < bw; ++x) {
+                struct Cell *c = FIELD(bx1 + x, by1 + y);
+                set_view_pixel(buf + 4 * (y * bw + x), c ? cell_draw_color(c) : 0xffffff);
+            }
+        }
+    } else {
+        // Blend the mean colour of the block with white by how full it is
+        const struct Mip_Block *m = mip[level - 1];
+        const float area = 1 << (2 * level);
+        for (int64_t y = 0; y < bh; ++y) {
+            for (int64_t x = 0; x < bw; ++x) {
+                const struct Mip_Block *b = &m[(by1 + y) * mip_w[level - 1] + bx1 + x];
+                uint8_t *p = buf + 4 * (y * bw + x);
+                if (!b->count) {
+                    set_view_pixel(p, 0xffffff);
+                    continue;
+                }
+                const float a = sqrtf(b->count / area);
+                p[0] = 255.f * (1 - a) + a * b->r / b->count;
+                p[1] = 255.f * (1 - a) + a * b->g / b->count;
+                p[2] = 255.f * (1 - a) + a * b->b / b->count;
+            }
+        }
+    }
+
+    translate(window_w / 2, window_h / 2);
+    scale(view_zoom, view_zoom);
+    translate(-view_x, -view_y);
+
+    PROFILE_BEGIN(PHASE_DRAW_IMAGE_BUFFER);
+    draw_image_buffer(buf, bw, bh, bx1 << level, by1 << level, bw << level, bh << level);
+    PROFILE_END(PHASE_DRAW_IMAGE_BUFFER);
+}
+
+void draw() {
+    PROFILE_BEGIN(PHASE_DRAW);
+    draw_field();
+    PROFILE_END(PHASE_DRAW);
 
-    draw_image_buffer(buf, FIELD_W, FIELD_H, 0, 0, FIELD_W, FIELD_H);
+    if (exporter) export_frame();
+    if (recorder) record_frame();
 }
 
 void keydown(int key) {
@@ -480,11 +2547,257 @@ void keydown(int key) {
         ticks_per_second *= .5f;
         printf("%.0f tps\n", ticks_per_second);
         break;
+    case 'F':
+        as_fast_as_possible = !as_fast_as_possible;
+        if (as_fast_as_possible) printf("as fast as possible\n");
+        else printf("%.0f tps\n", ticks_per_second);
+        break;
+    case 0xbb: // +
+        zoom_view_at(1.25f, window_w / 2, window_h / 2);
+        break;
+    case 0xbd: // -
+        zoom_view_at(.8f, window_w / 2, window_h / 2);
+        break;
+    case 'W': pan_view(     0, -.125f); break;
+    case 'A': pan_view(-.125f,      0); break;
+    case 'S': pan_view(     0,  .125f); break;
+    case 'D': pan_view( .125f,      0); break;
+    case 0x24: // Home
+        view_zoom = 0;
+        break;
+    case 0x74: // F5
+        if (save_checkpoint(checkpoint_path)) printf("saved tick %lu to %s\n", tick_count, checkpoint_path);
+        break;
+    case 0x78: // F9
+        if (load_checkpoint(checkpoint_path)) printf("loaded tick %lu from %s\n", tick_count, checkpoint_path);
+        break;
+    case 'T': {
+        // Counts since the last time T was pressed
+        static struct Telemetry_Counters prev;
+        printf(TELEMETRY_CSV_HEADER);
+        print_telemetry(stdout, &prev);
+        break;
+    }
+#ifdef PROFILE
+    case 'P':
+        profile_print(stdout, profile_phase_names, PHASES_LEN, false);
+        break;
+#endif
+    case 0x20: // Space
+        paused = !paused;
+        printf(paused ? "paused at tick %lu\n" : "playing from tick %lu\n", tick_count);
+        break;
+    case 0xbc: // , rewinds and . fast forwards by ten seconds of playback
+        if (replaying) seek(tick_count > ticks_per_second * 10 ? tick_count - ticks_per_second * 10 : 0);
+        break;
+    case 0xbe:
+        if (replaying) seek(tick_count + ticks_per_second * 10);
+        break;
     }
 }
 
 void keyup(int key) {}
 
-void mousedown(int button) {}
+void mousedown(int button) {
+    switch (button) {
+    case 1:
+        view_dragging = true;
+        view_drag_x = mouse_x;
+        view_drag_y = mouse_y;
+        break;
+    case 4: zoom_view_at(1.25f, mouse_x, mouse_y); break; // Wheel up
+    case 5: zoom_view_at(.8f,   mouse_x, mouse_y); break; // Wheel down
+    }
+}
+
+void mouseup(int button) {
+    if (button == 1) view_dragging = false;
+}
+
+void run_headless() {
+    init();
+
+    const uint64_t frame_ticks = ticks_per_second / 60;
+    while (!stop_tick || tick_count < stop_tick) {
+        poll_background_checkpoint();
+
+        uint64_t ticks = frame_ticks;
+        if (stop_tick && stop_tick - tick_count < ticks) ticks = stop_tick - tick_count;
+        for (uint64_t i = 0; i < ticks; ++i) do_tick();
+
+        if (exporter) export_frame();
+        if (recorder) record_frame();
+    }
+
+    printf("tick %lu hash %016lx\n", tick_count, hash_world());
+    if (sparse_field) printf("%ld cells on %ld tiles of %dx%d\n", cell_arena.len, tiles_len, 1 << TILE_BITS, 1 << TILE_BITS);
+    if (page_size != PAGES_SMALL) print_page_sizes();
+}
+
+// Returns false if s names no page size
+bool parse_page_size(const char *s, enum Page_Size *size) {
+    if (!strcmp(s, "small")) *size = PAGES_SMALL;
+    else if (!strcmp(s, "thp")) *size = PAGES_TRANSPARENT;
+    else if (!strcmp(s, "huge")) *size = PAGES_HUGE;
+    else return false;
+    return true;
+}
+
+bool parse_size(const char *s, int64_t *w, int64_t *h) {
+    return sscanf(s, "%ldx%ld", w, h) == 2;
+}
+
+// Lines of "name = value", # starts a comment. Returns false on anything it
+// doesn't understand.
+bool load_config(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        eprintf("Could not open %s\n", path);
+        return false;
+    }
+
+    char line[256];
+    for (int64_t line_number = 1; fgets(line, sizeof(line), f); ++line_number) {
+        char *comment = strchr(line, '#');
+        if (comment) *comment = 0;
+
+        char name[64];
+        double value;
+        char rest;
+        if (strspn(line, " \t\r\n") == strlen(line)) continue;
+
+        bool ok = sscanf(line, " %63[a-z_] = %lf %c", name, &value, &rest) == 2;
+        if (!ok) ;
+        else if (!strcmp(name, "field_w")) field_w = value;
+        else if (!strcmp(name, "field_h")) field_h = value;
+        else if (!strcmp(name, "initial_cells")) initial_cells_len = value;
+        else if (!strcmp(name, "synapses")) synapses_len = value;
+        else if (!strcmp(name, "mutation_chance")) mutation_chance = value;
+        else if (!strcmp(name, "minimum_metabolism")) minimum_metabolism = value;
+        else if (!strcmp(name, "energy_after_mitosis")) energy_multiplied_after_mitosis = value;
+        else if (!strcmp(name, "sparse_field")) sparse_field = value;
+        else if (!strcmp(name, "quantised_brains")) quantised_brains = value;
+        else ok = false;
+
+        if (!ok) {
+            eprintf("%s:%ld: expected one of field_w, field_h, initial_cells, synapses, mutation_chance, minimum_metabolism, energy_after_mitosis, sparse_field or quantised_brains = NUMBER\n",
+                    path, line_number);
+            fclose(f);
+            return false;
+        }
+    }
+    fclose(f);
+    return true;
+}
 
-void mouseup(int button) {}
+void usage(const char *name) {
+    eprintf("Usage: %s [options]\n", name);
+    eprintf("    -c PATH    Save checkpoints on F5 to PATH, load them on F9 (default eco.ckpt)\n");
+    eprintf("    -r PATH    Start from the checkpoint at PATH\n");
+    eprintf("    -d DIR     Write checkpoints to DIR in the background\n");
+    eprintf("    -t TICKS   Ticks between background checkpoints, at most what a seek replays (default %d)\n", CHECKPOINT_INTERVAL_TICKS);
+    eprintf("    -i SECONDS Space background checkpoints by time instead, seeks then replay any number of ticks\n");
+    eprintf("    -p DIR     Play back the run checkpointed in DIR, , and . seek, space pauses\n");
+    eprintf("    -k COUNT   Keep only the newest COUNT background checkpoints, 0 keeps all (default 10)\n");
+    eprintf("    -j PATH    Journal births, deaths and moves to PATH, read it with journal_dump\n");
+    eprintf("    -y PATH    Write the family tree of the genomes to PATH, read it with phylogeny_dump\n");
+    eprintf("    -x PATH    Export frames of the whole field to PATH, - for stdout\n");
+    eprintf("    -X FORMAT  Export as y4m or ppm (default y4m)\n");
+    eprintf("    -e N       Export only every Nth frame (default 1)\n");
+    eprintf("    -F FPS     Play the export at FPS frames a second (default 60 / N, real time)\n");
+    eprintf("    -R PATH    Record every frame to PATH, play it back with player\n");
+    eprintf("    -K N       Make every Nth recorded frame a keyframe (default 300)\n");
+    eprintf("    -m PATH    Write counts of what the cells did to PATH as CSV, T prints them\n");
+    eprintf("    -M TICKS   Ticks between lines of counts (default 1024000)\n");
+    eprintf("    -g WxH     Size of the field (default %dx%d), faster when both are powers of two\n", FIELD_W, FIELD_H);
+    eprintf("    -n CELLS   Random cells to start with (default %d)\n", INITIAL_CELLS_LEN);
+    eprintf("    -l COUNT   Synapses of every cell, up to %d (default %d)\n", SYNAPSES_MAX, SYNAPSES_LEN);
+    eprintf("    -u CHANCE  Chance of every gene mutating at birth (default %g)\n", MUTATION_CHANCE);
+    eprintf("    -b MIN     Least metabolism of new cells, what they burn on top of it is random (default %g)\n", MINIMUM_METABOLISM);
+    eprintf("    -E FRAC    Fraction of the energy parent and child keep at birth (default %g)\n", ENERGY_MULTIPLIED_AFER_MITOSIS);
+    eprintf("    -S         Keep only the parts of the field with cells on them, for huge fields, needs -H\n");
+    eprintf("    -q         Run the brains in fixed point, approximately\n");
+    eprintf("    -P PAGES   Keep the cells and the field in small, thp or huge (2 MB) pages, -H prints what we got (default small)\n");
+    eprintf("    -f PATH    Read the above from PATH as lines of e.g. field_w = 1024, options apply in order\n");
+#ifdef CHECK_KERNELS
+    eprintf("    -C N       Check every Nth cell update against the reference kernels (default 1)\n");
+    eprintf("    -T DIFF    Let neurons differ by up to DIFF from the reference (default 0)\n");
+#endif
+#ifdef PROFILE
+    eprintf("    P prints where the time went so far, everything is printed on exit\n");
+#endif
+    eprintf("    -H         Run without a window, as fast as possible\n");
+    eprintf("    -s TICK    Stop at TICK when running without a window\n");
+    exit(-1);
+}
+
+int main(int argc, char **argv) {
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "-c") && i + 1 < argc) checkpoint_path = argv[++i];
+        else if (!strcmp(argv[i], "-r") && i + 1 < argc) restore_path = argv[++i];
+        else if (!strcmp(argv[i], "-d") && i + 1 < argc) checkpoint_dir = argv[++i];
+        else if (!strcmp(argv[i], "-i") && i + 1 < argc) { checkpoint_interval_seconds = atof(argv[++i]); checkpoint_interval_ticks = 0; }
+        else if (!strcmp(argv[i], "-t") && i + 1 < argc) checkpoint_interval_ticks = atoll(argv[++i]);
+        else if (!strcmp(argv[i], "-p") && i + 1 < argc) checkpoint_dir = argv[++i], replaying = true;
+        else if (!strcmp(argv[i], "-k") && i + 1 < argc) checkpoint_retention = atoll(argv[++i]);
+        else if (!strcmp(argv[i], "-j") && i + 1 < argc) journal_path = argv[++i];
+        else if (!strcmp(argv[i], "-y") && i + 1 < argc) phylogeny_path = argv[++i];
+        else if (!strcmp(argv[i], "-x") && i + 1 < argc) export_path = argv[++i];
+        else if (!strcmp(argv[i], "-X") && i + 1 < argc) export_format = !strcmp(argv[++i], "ppm") ? VIDEO_PPM : VIDEO_Y4M;
+        else if (!strcmp(argv[i], "-e") && i + 1 < argc) export_every = atoll(argv[++i]);
+        else if (!strcmp(argv[i], "-F") && i + 1 < argc) export_fps = atoll(argv[++i]);
+        else if (!strcmp(argv[i], "-R") && i + 1 < argc) record_path = argv[++i];
+        else if (!strcmp(argv[i], "-K") && i + 1 < argc) record_keyframe_interval = atoll(argv[++i]);
+        else if (!strcmp(argv[i], "-m") && i + 1 < argc) telemetry_path = argv[++i];
+        else if (!strcmp(argv[i], "-M") && i + 1 < argc) telemetry_interval = atoll(argv[++i]);
+        else if (!strcmp(argv[i], "-H")) headless = true;
+        else if (!strcmp(argv[i], "-g") && i + 1 < argc) { if (!parse_size(argv[++i], &field_w, &field_h)) usage(argv[0]); }
+        else if (!strcmp(argv[i], "-n") && i + 1 < argc) initial_cells_len = atoll(argv[++i]);
+        else if (!strcmp(argv[i], "-l") && i + 1 < argc) synapses_len = atoll(argv[++i]);
+        else if (!strcmp(argv[i], "-u") && i + 1 < argc) mutation_chance = atof(argv[++i]);
+        else if (!strcmp(argv[i], "-b") && i + 1 < argc) minimum_metabolism = atof(argv[++i]);
+        else if (!strcmp(argv[i], "-E") && i + 1 < argc) energy_multiplied_after_mitosis = atof(argv[++i]);
+        else if (!strcmp(argv[i], "-S")) sparse_field = true;
+        else if (!strcmp(argv[i], "-q")) quantised_brains = true;
+        else if (!strcmp(argv[i], "-P") && i + 1 < argc) { if (!parse_page_size(argv[++i], &page_size)) usage(argv[0]); }
+        else if (!strcmp(argv[i], "-f") && i + 1 < argc) { if (!load_config(argv[++i])) exit(-1); }
+#ifdef CHECK_KERNELS
+        else if (!strcmp(argv[i], "-C") && i + 1 < argc) check_every = atoll(argv[++i]);
+        else if (!strcmp(argv[i], "-T") && i + 1 < argc) check_tolerance = atof(argv[++i]);
+#endif
+        else if (!strcmp(argv[i], "-s") && i + 1 < argc) stop_tick = atoll(argv[++i]);
+        else usage(argv[0]);
+    }
+    if (export_every < 1 || export_fps < 0 || record_keyframe_interval < 1 || telemetry_interval < 1) usage(argv[0]);
+    if (!checkpoint_interval_ticks && checkpoint_interval_seconds <= 0) usage(argv[0]);
+    if (field_w < 1 || field_h < 1 || synapses_len < 0 || synapses_len > SYNAPSES_MAX ||
+        initial_cells_len < 0 || initial_cells_len > field_w * field_h) {
+        usage(argv[0]);
+    }
+    // There is nothing to draw, export or record a sparse field from
+    if (sparse_field && (!headless || export_path || record_path)) {
+        eprintf("A sparse field only runs without a window, exports or recordings\n");
+        exit(-1);
+    }
+#ifdef CHECK_KERNELS
+    if (check_every < 1) usage(argv[0]);
+#endif
+    // Otherwise every background checkpoint would fail on its own
+    if (checkpoint_dir && !replaying) {
+        struct stat st;
+        if (mkdir(checkpoint_dir, 0777) && (errno != EEXIST || stat(checkpoint_dir, &st) || !S_ISDIR(st.st_mode))) {
+            eprintf("Could not make the directory %s\n", checkpoint_dir);
+            exit(-1);
+        }
+        atexit(finish_background_checkpoint);
+    }
+
+    if (headless) {
+        run_headless();
+        return 0;
+    }
+
+    pshtv_main_loop("Eco", 800, 600);
+    return 0;
+}
+#endif // ECO_LIBRARY
@@ -0,0 +1,335 @@
+#ifndef JOURNAL_H_
+#define JOURNAL_H_
+
+// An append-only binary journal of cell births, deaths and moves.
+//
+// The file starts with a Journal_File_Header followed by blocks. Every block
+// is a Journal_Block_Header and then that many bytes of records. Records are
+// LEB128 varints. The first is (tick delta << 2 | type), the tick delta being
+// from the previous record of the block or from the base tick of the block
+// for the first one. Then depending on the type:
+//     JOURNAL_BIRTH: id, parent id + 1 (0 when spawned), x, y, color
+//     JOURNAL_DEATH: id << 1 | eaten (starved otherwise)
+//     JOURNAL_MOVE:  id << 2 | direction (0 up, 1 right, 2 down, 3 left)
+//     JOURNAL_RESET: nothing, the world was replaced by a checkpoint
+// Ids are arena slots, they are reused after a death. After a reset they
+// mean other cells, the ones of the checkpoint, which are born right after
+// it as if spawned. A reset starts a block, as ticks may go back at one.
+//
+// Every thread appends to its own Journal_Buffer. Full blocks are handed to a
+// writer thread, so the simulation only ever waits on the disk when it is too
+// slow to keep up with JOURNAL_BLOCKS blocks in flight.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+
+#define JOURNAL_MAGIC "ECOJRNL"
+#define JOURNAL_VERSION 2
+#define JOURNAL_BLOCK_SIZE (1 << 20)
+#define JOURNAL_BLOCKS 8
+#define JOURNAL_MAX_RECORD 64
+
+enum Journal_Type {
+    JOURNAL_BIRTH,
+    JOURNAL_DEATH,
+    JOURNAL_MOVE,
+    JOURNAL_RESET,
+};
+
+struct Journal_File_Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t pad;
+    int64_t field_w;
+    int64_t field_h;
+};
+
+struct Journal_Block_Header {
+    uint32_t len;
+    uint32_t thread;
+    uint64_t base_tick;
+};
+
+struct Journal_Block {
+    struct Journal_Block_Header header;
+    uint8_t data[JOURNAL_BLOCK_SIZE];
+};
+
+struct Journal {
+    FILE *file;
+    pthread_t writer;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    bool closing;
+
+    // Full blocks waiting for the writer, oldest first
+    struct Journal_Block *queue[JOURNAL_BLOCKS];
+    int64_t queue_len;
+    // Blocks nobody is using
+    struct Journal_Block *spare[JOURNAL_BLOCKS];
+    int64_t spare_len;
+    int64_t blocks_len;
+
+    uint64_t bytes_written;
+    uint64_t waits; // How many times a buffer had to wait for the writer
+};
+
+struct Journal_Buffer {
+    struct Journal *journal;
+    struct Journal_Block *block;
+    uint32_t thread;
+    uint64_t last_tick;
+};
+
+void *journal_writer(void *arg) {
+    struct Journal *j = arg;
+
+    pthread_mutex_lock(&j->mutex);
+    while (1) {
+        while (!j->queue_len && !j->closing) pthread_cond_wait(&j->cond, &j->mutex);
+        if (!j->queue_len) break;
+
+        struct Journal_Block *b = j->queue[0];
+        memmove(j->queue, j->queue + 1, sizeof(*j->queue) * --j->queue_len);
+
+        pthread_mutex_unlock(&j->mutex);
+        const size_t size = sizeof(b->header) + b->header.len;
+        if (fwrite(b, size, 1, j->file) != 1) fprintf(stderr, "Could not write to the journal\n");
+        pthread_mutex_lock(&j->mutex);
+
+        j->bytes_written += size;
+        j->spare[j->spare_len++] = b;
+        pthread_cond_broadcast(&j->cond);
+    }
+    pthread_mutex_unlock(&j->mutex);
+
+    return NULL;
+}
+
+struct Journal *journal_open(const char *path, int64_t field_w, int64_t field_h) {
+    FILE *f = fopen(path, "wb");
+    if (!f) return NULL;
+
+    struct Journal_File_Header h = {
+        .magic = JOURNAL_MAGIC,
+        .version = JOURNAL_VERSION,
+        .field_w = field_w,
+        .field_h = field_h,
+    };
+    if (fwrite(&h, sizeof(h), 1, f) != 1) {
+        fclose(f);
+        return NULL;
+    }
+
+    struct Journal *j = calloc(1, sizeof(*j));
+    j->file = f;
+    pthread_mutex_init(&j->mutex, NULL);
+    pthread_cond_init(&j->cond, NULL);
+    pthread_create(&j->writer, NULL, journal_writer, j);
+    return j;
+}
+
+// Hand the block of the buffer to the writer and take an empty one
+void journal_flush_buffer(struct Journal_Buffer *b) {
+    struct Journal *j = b->journal;
+
+    pthread_mutex_lock(&j->mutex);
+    if (b->block && b->block->header.len) {
+        while (j->queue_len == JOURNAL_BLOCKS) {
+            ++j->waits;
+            pthread_cond_wait(&j->cond, &j->mutex);
+        }
+        j->queue[j->queue_len++] = b->block;
+        b->block = NULL;
+        pthread_cond_broadcast(&j->cond);
+    }
+    if (!b->block) {
+        if (j->spare_len) {
+            b->block = j->spare[--j->spare_len];
+        } else if (j->blocks_len < JOURNAL_BLOCKS) {
+            b->block = malloc(sizeof(*b->block));
+            ++j->blocks_len;
+        } else {
+            ++j->waits;
+            while (!j->spare_len) pthread_cond_wait(&j->cond, &j->mutex);
+            b->block = j->spare[--j->spare_len];
+        }
+    }
+    pthread_mutex_unlock(&j->mutex);
+
+    b->block->header.len = 0;
+    b->block->header.thread = b->thread;
+    b->block->header.base_tick = b->last_tick;
+}
+
+void journal_init_buffer(struct Journal_Buffer *b, struct Journal *j, uint32_t thread, uint64_t tick) {
+    b->journal = j;
+    b->block = NULL;
+    b->thread = thread;
+    b->last_tick = tick;
+    journal_flush_buffer(b);
+}
+
+// Flushes the buffers, waits for the writer to finish and closes the file.
+// j itself is left to the caller to free, so its counts can still be read.
+void journal_close(struct Journal *j, struct Journal_Buffer *buffers, int64_t buffers_len) {
+    for (int64_t i = 0; i < buffers_len; ++i) journal_flush_buffer(buffers + i);
+
+    pthread_mutex_lock(&j->mutex);
+    j->closing = true;
+    pthread_cond_broadcast(&j->cond);
+    pthread_mutex_unlock(&j->mutex);
+    pthread_join(j->writer, NULL);
+
+    fclose(j->file);
+    for (int64_t i = 0; i < buffers_len; ++i) free(buffers[i].block);
+    for (int64_t i = 0; i < j->spare_len; ++i) free(j->spare[i]);
+    pthread_mutex_destroy(&j->mutex);
+    pthread_cond_destroy(&j->cond);
+}
+
+void journal_put_varint(struct Journal_Buffer *b, uint64_t v) {
+    uint8_t *p = b->block->data + b->block->header.len;
+    while (v >= 0x80) {
+        *p++ = v | 0x80;
+        v >>= 7;
+    }
+    *p++ = v;
+    b->block->header.len = p - b->block->data;
+}
+
+void journal_begin_record(struct Journal_Buffer *b, uint64_t tick, enum Journal_Type type) {
+    if (b->block->header.len + JOURNAL_MAX_RECORD > JOURNAL_BLOCK_SIZE) {
+        journal_flush_buffer(b);
+    }
+    journal_put_varint(b, (tick - b->last_tick) << 2 | type);
+    b->last_tick = tick;
+}
+
+void journal_birth(struct Journal_Buffer *b, uint64_t tick, uint64_t id, int64_t parent, int64_t x, int64_t y, uint32_t color) {
+    journal_begin_record(b, tick, JOURNAL_BIRTH);
+    journal_put_varint(b, id);
+    journal_put_varint(b, parent + 1);
+    journal_put_varint(b, x);
+    journal_put_varint(b, y);
+    journal_put_varint(b, color);
+}
+
+void journal_death(struct Journal_Buffer *b, uint64_t tick, uint64_t id, bool eaten) {
+    journal_begin_record(b, tick, JOURNAL_DEATH);
+    journal_put_varint(b, id << 1 | eaten);
+}
+
+void journal_move(struct Journal_Buffer *b, uint64_t tick, uint64_t id, int8_t dx, int8_t dy) {
+    // Moving nowhere only turns the cell around, which we don't track
+    if (!dx && !dy) return;
+    const uint64_t dir = dy < 0 ? 0 : dx > 0 ? 1 : dy > 0 ? 2 : 3;
+    journal_begin_record(b, tick, JOURNAL_MOVE);
+    journal_put_varint(b, id << 2 | dir);
+}
+
+void journal_reset(struct Journal_Buffer *b, uint64_t tick) {
+    b->last_tick = tick;
+    journal_flush_buffer(b);
+    journal_begin_record(b, tick, JOURNAL_RESET);
+}
+
+// Reading it back
+
+struct Journal_Event {
+    enum Journal_Type type;
+    uint64_t tick;
+    uint64_t id;
+    int64_t parent; // -1 when spawned
+    int64_t x;
+    int64_t y;
+    uint32_t color;
+    bool eaten;
+    int8_t dx;
+    int8_t dy;
+};
+
+struct Journal_Reader {
+    FILE *file;
+    struct Journal_File_Header header;
+    struct Journal_Block block;
+    uint32_t pos;
+    uint64_t last_tick;
+};
+
+bool journal_open_reader(struct Journal_Reader *r, const char *path) {
+    r->file = fopen(path, "rb");
+    if (!r->file) return false;
+    if (fread(&r->header, sizeof(r->header), 1, r->file) != 1 ||
+        memcmp(r->header.magic, JOURNAL_MAGIC, sizeof(r->header.magic)) ||
+        r->header.version != JOURNAL_VERSION) {
+        fclose(r->file);
+        return false;
+    }
+    r->block.header.len = 0;
+    r->pos = 0;
+    return true;
+}
+
+uint64_t journal_get_varint(struct Journal_Reader *r) {
+    uint64_t v = 0;
+    for (int shift = 0; r->pos < r->block.header.len; shift += 7) {
+        const uint8_t byte = r->block.data[r->pos++];
+        v |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) break;
+    }
+    return v;
+}
+
+// False at the end of the journal
+bool journal_next(struct Journal_Reader *r, struct Journal_Event *e) {
+    while (r->pos >= r->block.header.len) {
+        if (fread(&r->block.header, sizeof(r->block.header), 1, r->file) != 1) return false;
+        if (r->block.header.len > JOURNAL_BLOCK_SIZE ||
+            fread(r->block.data, r->block.header.len, 1, r->file) != 1) {
+            fprintf(stderr, "The journal is truncated\n");
+            return false;
+        }
+        r->pos = 0;
+        r->last_tick = r->block.header.base_tick;
+    }
+
+    const uint64_t head = journal_get_varint(r);
+    e->type = head & 3;
+    e->tick = r->last_tick += head >> 2;
+
+    uint64_t v;
+    switch (e->type) {
+    case JOURNAL_BIRTH:
+        e->id = journal_get_varint(r);
+        e->parent = (int64_t)journal_get_varint(r) - 1;
+        e->x = journal_get_varint(r);
+        e->y = journal_get_varint(r);
+        e->color = journal_get_varint(r);
+        break;
+    case JOURNAL_DEATH:
+        v = journal_get_varint(r);
+        e->id = v >> 1;
+        e->eaten = v & 1;
+        break;
+    case JOURNAL_MOVE:
+        v = journal_get_varint(r);
+        e->id = v >> 2;
+        e->dx = (int8_t[]){ 0, 1, 0, -1 }[v & 3];
+        e->dy = (int8_t[]){ -1, 0, 1, 0 }[v & 3];
+        break;
+    case JOURNAL_RESET:
+        break;
+    }
+    return true;
+}
+
+void journal_close_reader(struct Journal_Reader *r) {
+    fclose(r->file);
+}
+
+#endif // JOURNAL_H_
@@ -0,0 +1,59 @@
+#include <stdio.h>
+#include <string.h>
+#include "journal.h"
+
+// Streams a journal written with `game -j PATH` back as text, one event per
+// line, or with -s just counts the events.
+int main(int argc, char **argv) {
+    const char *path = NULL;
+    bool summary = false;
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "-s")) summary = true;
+        else path = argv[i];
+    }
+    if (!path) {
+        fprintf(stderr, "Usage: %s [-s] JOURNAL\n", argv[0]);
+        return -1;
+    }
+
+    struct Journal_Reader r;
+    if (!journal_open_reader(&r, path)) {
+        fprintf(stderr, "%s is not a journal\n", path);
+        return -1;
+    }
+
+    uint64_t births = 0, spawns = 0, starved = 0, eaten = 0, moves = 0, resets = 0;
+    uint64_t first_tick = UINT64_MAX, last_tick = 0;
+    struct Journal_Event e;
+    while (journal_next(&r, &e)) {
+        if (e.tick < first_tick) first_tick = e.tick;
+        if (e.tick > last_tick) last_tick = e.tick;
+
+        switch (e.type) {
+        case JOURNAL_BIRTH:
+            if (e.parent < 0) ++spawns;
+            else ++births;
+            if (!summary) printf("%lu birth %lu parent %ld at %ld %ld color %06x\n", e.tick, e.id, e.parent, e.x, e.y, e.color);
+            break;
+        case JOURNAL_DEATH:
+            if (e.eaten) ++eaten;
+            else ++starved;
+            if (!summary) printf("%lu death %lu %s\n", e.tick, e.id, e.eaten ? "eaten" : "starved");
+            break;
+        case JOURNAL_MOVE:
+            ++moves;
+            if (!summary) printf("%lu move %lu by %d %d\n", e.tick, e.id, e.dx, e.dy);
+            break;
+        case JOURNAL_RESET:
+            ++resets;
+            if (!summary) printf("%lu reset, a checkpoint was loaded\n", e.tick);
+            break;
+        }
+    }
+    journal_close_reader(&r);
+
+    if (summary) {
+        printf("field %ldx%ld, ticks %lu to %lu\n", r.header.field_w, r.header.field_h, first_tick, last_tick);
+        printf("spawns %lu\nbirths %lu\nstarved %lu\neaten %lu\nmoves %lu\nresets %lu\n", spawns, births, starved, eaten, moves, resets);
+    }
+}
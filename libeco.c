@@ -0,0 +1,154 @@
+// The library in eco.h. This is game.c without the window, built with
+// -fvisibility=hidden so only the functions of eco.h are seen from outside.
+
+#define ECO_LIBRARY
+#include "game.c"
+#include "eco.h"
+
+// Eco_Cell is read straight out of the arena
+#define SAME_FIELD(name) \
+    _Static_assert(offsetof(struct Cell, name) == offsetof(struct Eco_Cell, name) && \
+                   sizeof(((struct Cell*)0)->name) == sizeof(((struct Eco_Cell*)0)->name), #name);
+SAME_FIELD(x) SAME_FIELD(y) SAME_FIELD(dir_x) SAME_FIELD(dir_y) SAME_FIELD(color) SAME_FIELD(energy)
+SAME_FIELD(metabolism) SAME_FIELD(sleeping) SAME_FIELD(genome) SAME_FIELD(lineage) SAME_FIELD(neurons) SAME_FIELD(neuron_combs)
+SAME_FIELD(next) SAME_FIELD(prev) SAME_FIELD(synapses)
+_Static_assert(sizeof(struct Cell) == sizeof(struct Eco_Cell), "struct Cell");
+_Static_assert(NEURONS_LEN == ECO_NEURONS_LEN && SYNAPSES_MAX == ECO_SYNAPSES_MAX, "lengths");
+_Static_assert(PIXEL_OCCUPIED == ECO_PIXEL_OCCUPIED && PIXEL_SLEEPING == ECO_PIXEL_SLEEPING, "pixels");
+
+struct Eco_World {
+    struct Eco_Params params;
+    // The globals of game.c while the world isn't running
+    struct World_State state;
+};
+
+struct Eco_Params eco_default_params() {
+    return (struct Eco_Params){
+        .field_w = FIELD_W,
+        .field_h = FIELD_H,
+        .initial_cells = INITIAL_CELLS_LEN,
+        .synapses = SYNAPSES_LEN,
+        .mutation_chance = MUTATION_CHANCE,
+        .minimum_metabolism = MINIMUM_METABOLISM,
+        .energy_after_mitosis = ENERGY_MULTIPLIED_AFER_MITOSIS,
+        .seed = 1,
+    };
+}
+
+struct Eco_World *eco_world_create(const struct Eco_Params *params) {
+    const struct Eco_Params *p = params;
+    if (p->field_w < 1 || p->field_h < 1 || p->synapses < 0 || p->synapses > SYNAPSES_MAX ||
+        p->initial_cells < 0 || p->initial_cells > p->field_w * p->field_h) {
+        return NULL;
+    }
+
+    field_w = p->field_w;
+    field_h = p->field_h;
+    initial_cells_len = p->initial_cells;
+    synapses_len = p->synapses;
+    mutation_chance = p->mutation_chance;
+    minimum_metabolism = p->minimum_metabolism;
+    energy_multiplied_after_mitosis = p->energy_after_mitosis;
+    sparse_field = p->sparse_field;
+    quantised_brains = p->quantised_brains;
+    init_world();
+    tick_cursor = NULL;
+    tick_count = 0;
+    memset(&telemetry_counters, 0, sizeof(telemetry_counters));
+    seed_rand64(p->seed);
+    for (int64_t i = 0; i < initial_cells_len; ++i) create_random_cell();
+
+    struct Eco_World *w = calloc(1, sizeof(*w));
+    w->params = *p;
+    save_world_state(&w->state);
+    return w;
+}
+
+void eco_world_destroy(struct Eco_World *w) {
+    load_world_state(&w->state);
+    deinit_world();
+    free(w);
+}
+
+uint64_t eco_step(struct Eco_World *w, uint64_t sweeps) {
+    load_world_state(&w->state);
+    const uint64_t start = tick_count;
+    while (sweeps) {
+        do_tick();
+        if (!tick_cursor) --sweeps;
+    }
+    save_world_state(&w->state);
+    return tick_count - start;
+}
+
+const struct Eco_Params *eco_params(const struct Eco_World *w) {
+    return &w->params;
+}
+
+uint64_t eco_tick(const struct Eco_World *w) {
+    return w->state.tick_count;
+}
+
+int64_t eco_population(const struct Eco_World *w) {
+    return w->state.cell_arena.len;
+}
+
+struct Eco_Stats eco_stats(const struct Eco_World *w) {
+    const struct Telemetry_Counters *t = &w->state.telemetry_counters;
+    struct Eco_Stats s = {
+        .spawns = t->spawns,
+        .births = t->births,
+        .starved = t->starved,
+        .eaten = t->eaten,
+        .moves = t->moves,
+        .sleeps = t->sleeps,
+        .wakes = t->wakes,
+    };
+    for (const struct Cell *it = w->state.cell_arena.head; it; it = it->next) {
+        ++s.population;
+        s.sleeping += it->sleeping;
+        s.mean_energy += it->energy;
+        s.mean_metabolism += it->metabolism;
+    }
+    if (s.population) {
+        s.mean_energy /= s.population;
+        s.mean_metabolism /= s.population;
+    }
+    return s;
+}
+
+int64_t eco_species(const struct Eco_World *w, struct Eco_Species *species, int64_t max) {
+    struct Species **list = w->state.species_list;
+    for (int64_t i = 0; i < arr_len(list) && i < max; ++i) {
+        species[i] = (struct Eco_Species){
+            .genome = list[i]->genome,
+            .count = list[i]->count,
+            .first_tick = list[i]->first_tick,
+            .representative = (const struct Eco_Cell *)&list[i]->representative,
+        };
+    }
+    return arr_len(list);
+}
+
+const uint32_t *eco_pixels(const struct Eco_World *w) {
+    return w->state.pixels;
+}
+
+int64_t eco_occupied(struct Eco_World *w, int64_t x, int64_t y, int64_t width, int64_t height) {
+    load_world_state(&w->state);
+    if (!sparse_field) return occupied_in(x, y, width, height);
+    int64_t sum = 0;
+    for (int64_t i = x; i < x + width; ++i) {
+        for (int64_t j = y; j < y + height; ++j) sum += !!field_at(i, j);
+    }
+    return sum;
+}
+
+const struct Eco_Cell *eco_cells(const struct Eco_World *w) {
+    return (const struct Eco_Cell *)w->state.cell_arena.head;
+}
+
+uint64_t eco_hash(struct Eco_World *w) {
+    load_world_state(&w->state);
+    return hash_world();
+}
@@ -0,0 +1,54 @@
+#include <stdio.h>
+#include <stdint.h>
+#include "eco.h"
+
+// Checks that worlds sharing a thread don't leak into each other: a quantised
+// and a float world stepped by turns must hash the same as each run alone.
+// Prints the hashes and returns non-zero when they differ.
+
+#define TEST_SWEEPS 5
+#define TEST_CHUNKS 4
+
+struct Eco_Params test_params(_Bool quantised) {
+    struct Eco_Params p = eco_default_params();
+    p.field_w = 256;
+    p.field_h = 256;
+    p.initial_cells = 2000;
+    p.quantised_brains = quantised;
+    return p;
+}
+
+uint64_t test_alone(_Bool quantised) {
+    const struct Eco_Params p = test_params(quantised);
+    struct Eco_World *w = eco_world_create(&p);
+    for (int i = 0; i < TEST_CHUNKS; ++i) eco_step(w, TEST_SWEEPS);
+    const uint64_t hash = eco_hash(w);
+    eco_world_destroy(w);
+    return hash;
+}
+
+int main() {
+    const uint64_t quantised_alone = test_alone(1);
+    const uint64_t float_alone = test_alone(0);
+
+    // The float world is created last, as that is what used to leak
+    const struct Eco_Params qp = test_params(1), fp = test_params(0);
+    struct Eco_World *q = eco_world_create(&qp);
+    struct Eco_World *f = eco_world_create(&fp);
+    for (int i = 0; i < TEST_CHUNKS; ++i) {
+        eco_step(q, TEST_SWEEPS);
+        eco_step(f, TEST_SWEEPS);
+    }
+    const uint64_t quantised_shared = eco_hash(q);
+    const uint64_t float_shared = eco_hash(f);
+    eco_world_destroy(q);
+    eco_world_destroy(f);
+
+    printf("quantised alone %016lx shared %016lx\n", quantised_alone, quantised_shared);
+    printf("float     alone %016lx shared %016lx\n", float_alone, float_shared);
+    if (quantised_alone != quantised_shared || float_alone != float_shared) {
+        fprintf(stderr, "Worlds on one thread changed each other\n");
+        return -1;
+    }
+    return 0;
+}
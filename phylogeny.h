@@ -0,0 +1,248 @@
+#ifndef PHYLOGENY_H_
+#define PHYLOGENY_H_
+
+// The family tree of the genomes, written as it grows.
+//
+// Every spawned cell and every birth that mutates starts a node of the tree,
+// the other births join the node of their parent. The file is a
+// Phylogeny_File_Header followed by records, all LEB128 varints. The first is
+// (tick delta << 1 | type), the tick delta being from the previous record.
+// Then depending on the type:
+//     PHYLOGENY_NODE: id, parent id + 1 (0 for roots), genes mutated, genome
+//     PHYLOGENY_END:  id, after which no cell of the node is alive
+// Ids count up from 0 and are never reused.
+//
+// Only the part of the tree needed to write the rest of it is kept in memory.
+// A node is dropped once it has neither cells nor children, and a node
+// without cells of its own and a single child is replaced by that child, so
+// every node left has cells or at least two children. That is at most twice
+// as many nodes as there are cells, however long the run.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "arr.h"
+
+#define PHYLOGENY_MAGIC "ECOPHYL"
+#define PHYLOGENY_VERSION 1
+
+enum Phylogeny_Type {
+    PHYLOGENY_NODE,
+    PHYLOGENY_END,
+};
+
+struct Phylogeny_File_Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t pad;
+    uint64_t tick;
+};
+
+// Nodes link by their index in Phylogeny.nodes, -1 being none
+struct Phylogeny_Node {
+    uint64_t id;
+    int64_t parent;
+    int64_t first_child;
+    int64_t prev_sibling;
+    int64_t next_sibling; // Also links the free nodes
+    int64_t cells;
+    int64_t children;
+};
+
+struct Phylogeny {
+    FILE *file;
+    struct Phylogeny_Node *nodes; // arr
+    int64_t free;
+    int64_t len;
+    int64_t peak_len;
+    uint64_t next_id;
+    uint64_t last_tick;
+    uint64_t bytes_written;
+};
+
+struct Phylogeny *phylogeny_open(const char *path, uint64_t tick) {
+    FILE *f = fopen(path, "wb");
+    if (!f) return NULL;
+
+    struct Phylogeny_File_Header h = {
+        .magic = PHYLOGENY_MAGIC,
+        .version = PHYLOGENY_VERSION,
+        .tick = tick,
+    };
+    fwrite(&h, sizeof(h), 1, f);
+
+    struct Phylogeny *p = calloc(1, sizeof(*p));
+    p->file = f;
+    p->nodes = arr_create(struct Phylogeny_Node);
+    p->free = -1;
+    p->last_tick = tick;
+    p->bytes_written = sizeof(h);
+    return p;
+}
+
+void phylogeny_close(struct Phylogeny *p) {
+    if (fclose(p->file)) fprintf(stderr, "Could not write the phylogeny\n");
+    arr_free(p->nodes);
+    free(p);
+}
+
+void phylogeny_put_varint(struct Phylogeny *p, uint64_t v) {
+    while (v >= 0x80) {
+        fputc(v | 0x80, p->file);
+        v >>= 7;
+        ++p->bytes_written;
+    }
+    fputc(v, p->file);
+    ++p->bytes_written;
+}
+
+void phylogeny_begin_record(struct Phylogeny *p, uint64_t tick, enum Phylogeny_Type type) {
+    phylogeny_put_varint(p, (tick - p->last_tick) << 1 | type);
+    p->last_tick = tick;
+}
+
+void phylogeny_unlink(struct Phylogeny *p, int64_t i) {
+    struct Phylogeny_Node *n = p->nodes + i;
+    if (n->prev_sibling >= 0) p->nodes[n->prev_sibling].next_sibling = n->next_sibling;
+    else if (n->parent >= 0) p->nodes[n->parent].first_child = n->next_sibling;
+    if (n->next_sibling >= 0) p->nodes[n->next_sibling].prev_sibling = n->prev_sibling;
+}
+
+void phylogeny_link(struct Phylogeny *p, int64_t i, int64_t parent) {
+    struct Phylogeny_Node *n = p->nodes + i;
+    n->parent = parent;
+    n->prev_sibling = -1;
+    n->next_sibling = -1;
+    if (parent < 0) return;
+    n->next_sibling = p->nodes[parent].first_child;
+    if (n->next_sibling >= 0) p->nodes[n->next_sibling].prev_sibling = i;
+    p->nodes[parent].first_child = i;
+}
+
+// A node of a single cell, with the parent node or -1 for a root.
+// Returns its index.
+int64_t phylogeny_add(struct Phylogeny *p, int64_t parent, uint64_t tick, uint64_t genes, uint64_t genome) {
+    int64_t i = p->free;
+    if (i >= 0) {
+        p->free = p->nodes[i].next_sibling;
+    } else {
+        i = arr_len(p->nodes);
+        arr_push(&p->nodes, (struct Phylogeny_Node){0});
+    }
+    if (++p->len > p->peak_len) p->peak_len = p->len;
+
+    struct Phylogeny_Node *n = p->nodes + i;
+    n->id = p->next_id++;
+    n->first_child = -1;
+    n->cells = 1;
+    n->children = 0;
+    phylogeny_link(p, i, parent);
+    if (parent >= 0) ++p->nodes[parent].children;
+
+    phylogeny_begin_record(p, tick, PHYLOGENY_NODE);
+    phylogeny_put_varint(p, n->id);
+    phylogeny_put_varint(p, parent >= 0 ? p->nodes[parent].id + 1 : 0);
+    phylogeny_put_varint(p, genes);
+    phylogeny_put_varint(p, genome);
+    return i;
+}
+
+// Drops nodes that are no longer needed, going up from node i
+void phylogeny_prune(struct Phylogeny *p, int64_t i) {
+    while (i >= 0 && !p->nodes[i].cells && p->nodes[i].children <= 1) {
+        struct Phylogeny_Node *n = p->nodes + i;
+        const int64_t parent = n->parent;
+        const bool spliced = n->children;
+        phylogeny_unlink(p, i);
+        // The only child takes the place of the node, so the parent keeps
+        // as many children
+        if (spliced) phylogeny_link(p, n->first_child, parent);
+        else if (parent >= 0) --p->nodes[parent].children;
+
+        n->next_sibling = p->free;
+        p->free = i;
+        --p->len;
+        i = spliced ? -1 : parent;
+    }
+}
+
+// A cell joined node i by a birth without mutations
+static inline void phylogeny_hold(struct Phylogeny *p, int64_t i) {
+    ++p->nodes[i].cells;
+}
+
+// A cell of node i died
+void phylogeny_release(struct Phylogeny *p, int64_t i, uint64_t tick) {
+    if (--p->nodes[i].cells) return;
+    phylogeny_begin_record(p, tick, PHYLOGENY_END);
+    phylogeny_put_varint(p, p->nodes[i].id);
+    phylogeny_prune(p, i);
+}
+
+// Reading it back
+
+struct Phylogeny_Event {
+    enum Phylogeny_Type type;
+    uint64_t tick;
+    uint64_t id;
+    int64_t parent; // -1 for roots
+    uint64_t genes;
+    uint64_t genome;
+};
+
+struct Phylogeny_Reader {
+    FILE *file;
+    struct Phylogeny_File_Header header;
+    uint64_t last_tick;
+};
+
+bool phylogeny_open_reader(struct Phylogeny_Reader *r, const char *path) {
+    r->file = fopen(path, "rb");
+    if (!r->file) return false;
+    if (fread(&r->header, sizeof(r->header), 1, r->file) != 1 ||
+        memcmp(r->header.magic, PHYLOGENY_MAGIC, sizeof(r->header.magic)) ||
+        r->header.version != PHYLOGENY_VERSION) {
+        fclose(r->file);
+        return false;
+    }
+    r->last_tick = r->header.tick;
+    return true;
+}
+
+// False at the end of the file
+bool phylogeny_get_varint(struct Phylogeny_Reader *r, uint64_t *v) {
+    *v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        const int byte = fgetc(r->file);
+        if (byte == EOF) return false;
+        *v |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+// False at the end of the phylogeny
+bool phylogeny_next(struct Phylogeny_Reader *r, struct Phylogeny_Event *e) {
+    uint64_t head, parent = 0;
+    if (!phylogeny_get_varint(r, &head)) return false;
+    e->type = head & 1;
+    e->tick = r->last_tick += head >> 1;
+
+    bool ok = phylogeny_get_varint(r, &e->id);
+    if (e->type == PHYLOGENY_NODE) {
+        ok = ok && phylogeny_get_varint(r, &parent) &&
+            phylogeny_get_varint(r, &e->genes) &&
+            phylogeny_get_varint(r, &e->genome);
+        e->parent = (int64_t)parent - 1;
+    }
+    if (!ok) fprintf(stderr, "The phylogeny is truncated\n");
+    return ok;
+}
+
+void phylogeny_close_reader(struct Phylogeny_Reader *r) {
+    fclose(r->file);
+}
+
+#endif // PHYLOGENY_H_
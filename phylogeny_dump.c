@@ -0,0 +1,83 @@
+#include <stdio.h>
+#include <string.h>
+#include "phylogeny.h"
+
+struct Dump_Node {
+    int64_t parent;
+    uint64_t tick;
+    uint64_t end_tick; // 0 while it has cells
+    uint64_t genes;
+    uint64_t genome;
+    int64_t refs; // Children with a living descendant, and 1 while it has cells
+};
+
+// Prints the nodes of a phylogeny written with `game -y PATH`. Branches that
+// died out are left out unless -a is given, -s just counts the nodes.
+int main(int argc, char **argv) {
+    const char *path = NULL;
+    bool summary = false, all = false;
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "-s")) summary = true;
+        else if (!strcmp(argv[i], "-a")) all = true;
+        else path = argv[i];
+    }
+    if (!path) {
+        fprintf(stderr, "Usage: %s [-s] [-a] PHYLOGENY\n", argv[0]);
+        return -1;
+    }
+
+    struct Phylogeny_Reader r;
+    if (!phylogeny_open_reader(&r, path)) {
+        fprintf(stderr, "%s is not a phylogeny\n", path);
+        return -1;
+    }
+
+    struct Dump_Node *nodes = arr_create(struct Dump_Node);
+    uint64_t roots = 0, ended = 0, last_tick = r.header.tick;
+    struct Phylogeny_Event e;
+    while (phylogeny_next(&r, &e)) {
+        last_tick = e.tick;
+        if (e.type == PHYLOGENY_NODE) {
+            if (e.id != arr_len(nodes) || e.parent >= (int64_t)e.id) {
+                fprintf(stderr, "Node %lu is out of order\n", e.id);
+                break;
+            }
+            arr_push(&nodes, ((struct Dump_Node){ e.parent, e.tick, 0, e.genes, e.genome, 1 }));
+            if (e.parent < 0) ++roots;
+            else ++nodes[e.parent].refs;
+            continue;
+        }
+
+        if (e.id >= arr_len(nodes) || nodes[e.id].end_tick) {
+            fprintf(stderr, "Node %lu ends twice or before it starts\n", e.id);
+            break;
+        }
+        ++ended;
+        nodes[e.id].end_tick = e.tick;
+        // The branch died out as far up as nothing else holds it
+        for (int64_t i = e.id; i >= 0 && !--nodes[i].refs; i = nodes[i].parent);
+    }
+    phylogeny_close_reader(&r);
+
+    uint64_t surviving = 0, deepest = 0;
+    for (int64_t i = 0; i < arr_len(nodes); ++i) {
+        const struct Dump_Node *n = nodes + i;
+        if (n->refs) {
+            ++surviving;
+            uint64_t depth = 0;
+            for (int64_t j = n->parent; j >= 0; j = nodes[j].parent) ++depth;
+            if (depth > deepest) deepest = depth;
+        }
+        if (summary || (!n->refs && !all)) continue;
+
+        printf("%ld parent %ld tick %lu genes %lu genome %016lx", i, n->parent, n->tick, n->genes, n->genome);
+        if (n->end_tick) printf(" ended %lu", n->end_tick);
+        printf("%s\n", n->refs ? "" : " extinct");
+    }
+
+    if (summary) {
+        printf("ticks %lu to %lu\n", r.header.tick, last_tick);
+        printf("nodes %ld\nroots %lu\nended %lu\nsurviving %lu\ndeepest %lu\n", arr_len(nodes), roots, ended, surviving, deepest);
+    }
+    arr_free(nodes);
+}
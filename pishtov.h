@@ -58,7 +58,7 @@ TODO In no particular order
     [ ] OS-independent network-programming
     [ ] 3D graphics
     [ ] Shaders
-    [ ] An optional define stating whether or not you want a main game loop or just the library functions
+    [X] An optional define stating whether or not you want a main game loop or just the library functions
     [X] Default Code::Blocks Windows compile
     [ ] WASM compile
     [ ] Android compile
@@ -76,6 +76,7 @@ extern "C" {
 #include <string.h>
 #include <stdint.h>
 #include <math.h>
+#include <time.h>
 
 #define eprintf(...) fprintf(stderr, __VA_ARGS__);
 
@@ -96,9 +97,11 @@ void pshtv_open_window(const char *name, int w, int h); // Open a window.
 void pshtv_handle_events(); // Ask the OS for new events and react accordingly.
 void pshtv_swap_buffers(); // Swap the OpenGL buffers. Can be a noop.
 void *pshtv_load_gl(const char *name); // Dynamically load an OpenGL function
+void pshtv_sleep(uint64_t ns); // Give the CPU away for about ns nanoseconds
 
 float mouse_x, mouse_y; // Automatically set to the mouse position on the window
 float window_w, window_h; // Automatically set to the window dimensions
+float max_fps = 60; // The main loop sleeps to not draw more often. 0 means no limit
 
 // The other part of the pishtov deals with actually drawing using OpenGL
 // It defines the following functions and variables:
@@ -120,6 +123,11 @@ void pshtv_redraw();
 // subject to change and/or removal at any time. Functions mentioned above are
 // more or less stable.
 
+// Define PISHTOV_SOFTWARE before including this header to draw without OpenGL.
+// Everything is then rasterised on the CPU and shown with MIT-SHM, which is
+// much faster than a software OpenGL on machines without a GPU. It only works
+// on X11 and needs -lXext instead of -lGL.
+
 #if defined(_WIN32) // Windows 32 or 64 bit
 
 #include <windows.h>
@@ -261,6 +269,10 @@ void pshtv_swap_buffers() {
     pshtv_SwapBuffers(pshtv_hdc);
 }
 
+void pshtv_sleep(uint64_t ns) {
+    Sleep(ns / 1000000);
+}
+
 #elif defined(__APPLE__)
 #error Apple not supported
 #elif defined(__ANDROID__)
@@ -271,8 +283,14 @@ void pshtv_swap_buffers() {
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
 #include <X11/keysymdef.h>
+#ifdef PISHTOV_SOFTWARE
+#include <X11/extensions/XShm.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#else
 #include <GL/gl.h>
 #include <GL/glx.h>
+#endif
 #include <dlfcn.h>
 #include <time.h>
 
@@ -280,6 +298,141 @@ Display *pshtv_display;
 Window pshtv_window;
 Atom pshtv_atom_wm_delete_window;
 
+#ifdef PISHTOV_SOFTWARE
+// The software backend draws into an XImage and presents it with
+// XShmPutImage. If the MIT-SHM extension is missing or refuses to attach (e.g.
+// the X server is on another machine) we fall back to plain XPutImage.
+GC pshtv_gc;
+Visual *pshtv_visual;
+int pshtv_depth;
+XImage *pshtv_ximage;
+XShmSegmentInfo pshtv_shm_info;
+int pshtv_use_shm;
+int pshtv_shm_failed;
+uint32_t *pshtv_pixels;
+int pshtv_pixels_w, pshtv_pixels_h, pshtv_pixels_stride;
+int pshtv_red_shift, pshtv_green_shift, pshtv_blue_shift;
+
+int pshtv_shm_error_handler(Display *display, XErrorEvent *ev) {
+    pshtv_shm_failed = 1;
+    return 0;
+}
+
+void pshtv_destroy_backbuffer() {
+    if (!pshtv_ximage) return;
+    if (pshtv_use_shm) {
+        XShmDetach(pshtv_display, &pshtv_shm_info);
+        XSync(pshtv_display, False);
+        pshtv_ximage->data = NULL;
+        XDestroyImage(pshtv_ximage);
+        shmdt(pshtv_shm_info.shmaddr);
+    } else {
+        XDestroyImage(pshtv_ximage); // Also frees the data
+    }
+    pshtv_ximage = NULL;
+    pshtv_pixels = NULL;
+}
+
+XImage *pshtv_create_shm_image(int w, int h) {
+    XImage *img = XShmCreateImage(pshtv_display, pshtv_visual, pshtv_depth, ZPixmap, NULL, &pshtv_shm_info, w, h);
+    if (!img) return NULL;
+
+    pshtv_shm_info.shmid = shmget(IPC_PRIVATE, img->bytes_per_line * img->height, IPC_CREAT | 0600);
+    if (pshtv_shm_info.shmid < 0) {
+        XDestroyImage(img);
+        return NULL;
+    }
+    pshtv_shm_info.shmaddr = img->data = shmat(pshtv_shm_info.shmid, NULL, 0);
+    pshtv_shm_info.readOnly = False;
+
+    // XShmAttach reports failure asynchronously, so we trap the error.
+    pshtv_shm_failed = 0;
+    int (*prev_handler)(Display*, XErrorEvent*) = XSetErrorHandler(pshtv_shm_error_handler);
+    XShmAttach(pshtv_display, &pshtv_shm_info);
+    XSync(pshtv_display, False);
+    XSetErrorHandler(prev_handler);
+
+    // The segment lives until both we and the server detach from it.
+    shmctl(pshtv_shm_info.shmid, IPC_RMID, NULL);
+
+    if (pshtv_shm_failed || img->data == (void*)-1) {
+        if (img->data != (void*)-1) shmdt(img->data);
+        img->data = NULL;
+        XDestroyImage(img);
+        return NULL;
+    }
+    return img;
+}
+
+void pshtv_resize_backbuffer(int w, int h) {
+    pshtv_destroy_backbuffer();
+    if (w <= 0 || h <= 0) return;
+
+    if (pshtv_use_shm) {
+        pshtv_ximage = pshtv_create_shm_image(w, h);
+        if (!pshtv_ximage) {
+            eprintf("Could not use MIT-SHM, falling back to XPutImage\n");
+            pshtv_use_shm = 0;
+        }
+    }
+
+    if (!pshtv_ximage) {
+        pshtv_ximage = XCreateImage(pshtv_display, pshtv_visual, pshtv_depth, ZPixmap, 0, NULL, w, h, 32, 0);
+        pshtv_ximage->data = malloc(pshtv_ximage->bytes_per_line * h);
+    }
+
+    if (pshtv_ximage->bits_per_pixel != 32) {
+        eprintf("Software rendering needs a 32 bits per pixel visual\n");
+        exit(-1);
+    }
+
+    pshtv_pixels = (uint32_t*)pshtv_ximage->data;
+    pshtv_pixels_w = w;
+    pshtv_pixels_h = h;
+    pshtv_pixels_stride = pshtv_ximage->bytes_per_line / 4;
+}
+
+void pshtv_open_window(const char *name, int w, int h) {
+    pshtv_display = XOpenDisplay(NULL);
+    if (pshtv_display == NULL) {
+        eprintf("Error opening X11 display\n")
+            exit(-1);
+    }
+
+    int screen_id = DefaultScreen(pshtv_display);
+    pshtv_visual = DefaultVisual(pshtv_display, screen_id);
+    pshtv_depth = DefaultDepth(pshtv_display, screen_id);
+
+    if (pshtv_visual->class != TrueColor ||
+        pshtv_visual->red_mask   != 0xff << (pshtv_red_shift   = __builtin_ctzl(pshtv_visual->red_mask  )) ||
+        pshtv_visual->green_mask != 0xff << (pshtv_green_shift = __builtin_ctzl(pshtv_visual->green_mask)) ||
+        pshtv_visual->blue_mask  != 0xff << (pshtv_blue_shift  = __builtin_ctzl(pshtv_visual->blue_mask ))) {
+        eprintf("Software rendering needs a TrueColor visual with 8 bits per channel\n");
+        exit(-1);
+    }
+
+    pshtv_window = XCreateSimpleWindow(pshtv_display, RootWindow(pshtv_display, screen_id), 0, 0, w, h, 0, BlackPixel(pshtv_display, screen_id), WhitePixel(pshtv_display, screen_id));
+
+    pshtv_atom_wm_delete_window = XInternAtom(pshtv_display, "WM_DELETE_WINDOW", False);
+    XSetWMProtocols(pshtv_display, pshtv_window, &pshtv_atom_wm_delete_window, 1);
+
+    pshtv_gc = XCreateGC(pshtv_display, pshtv_window, 0, NULL);
+    pshtv_use_shm = XShmQueryExtension(pshtv_display);
+
+    XSelectInput(pshtv_display, pshtv_window,
+                 PointerMotionMask |
+                 ButtonPressMask |
+                 ButtonReleaseMask |
+                 KeyPressMask |
+                 KeyReleaseMask |
+                 KeymapStateMask |
+                 StructureNotifyMask);
+
+    XStoreName(pshtv_display, pshtv_window, name);
+
+    XMapWindow(pshtv_display, pshtv_window);
+}
+#else
 void pshtv_open_window(const char *name, int w, int h) {
     int screen_id;
     GLXContext context;
@@ -348,6 +501,7 @@ void pshtv_open_window(const char *name, int w, int h) {
 
     XMapWindow(pshtv_display, pshtv_window);
 }
+#endif
 
 // TODO use KF86 keys as well
 int pshtv_translate_key(int native) {
@@ -627,6 +781,19 @@ void pshtv_handle_events() {
     }
 }
 
+#ifdef PISHTOV_SOFTWARE
+void pshtv_swap_buffers() {
+    if (!pshtv_ximage) return;
+    if (pshtv_use_shm) {
+        XShmPutImage(pshtv_display, pshtv_window, pshtv_gc, pshtv_ximage, 0, 0, 0, 0, pshtv_pixels_w, pshtv_pixels_h, False);
+        // We must not touch the pixels until the server is done reading them.
+        XSync(pshtv_display, False);
+    } else {
+        XPutImage(pshtv_display, pshtv_window, pshtv_gc, pshtv_ximage, 0, 0, 0, 0, pshtv_pixels_w, pshtv_pixels_h);
+        XFlush(pshtv_display);
+    }
+}
+#else
 void pshtv_swap_buffers() {
     glXSwapBuffers(pshtv_display, pshtv_window);
 }
@@ -637,9 +804,20 @@ void *pshtv_load_gl(const char *name) {
         gl_handle = dlopen("libGL.so", RTLD_LAZY);
     return dlsym(gl_handle, name);
 }
+#endif
+
+void pshtv_sleep(uint64_t ns) {
+    struct timespec ts = { .tv_sec = ns / 1000000000, .tv_nsec = ns % 1000000000 };
+    nanosleep(&ts, NULL);
+}
 
 #endif
 
+#if defined(PISHTOV_SOFTWARE) && defined(_WIN32)
+#error The software backend is only implemented for X11
+#endif
+
+#ifndef PISHTOV_SOFTWARE
 #include <GL/gl.h>
 #include <GL/glext.h>
 
@@ -1057,13 +1235,6 @@ void draw_image_buffer(uint8_t *buffer, uint32_t img_w, uint32_t img_h, float x,
     pglDeleteVertexArrays(1, &vao);
 }
 
-void fill_color(uint32_t c) {
-    pshtv_fill_color[0] =     (c >> 16 & 0xff) / 255.f;
-    pshtv_fill_color[1] =     (c >>  8 & 0xff) / 255.f;
-    pshtv_fill_color[2] =     (c       & 0xff) / 255.f;
-    pshtv_fill_color[3] = 1 - (c >> 24 & 0xff) / 255.f;
-}
-
 void fill_rect(float x, float y, float w, float h) {
     pshtv_quad_verts[pshtv_quad_verts_len++] = (struct Pshtv_Quad_Vert){ .pos = { x,     y     }, .col = { pshtv_fill_color[0], pshtv_fill_color[1], pshtv_fill_color[2], pshtv_fill_color[3] }, .z = pshtv_z };
     pshtv_quad_verts[pshtv_quad_verts_len++] = (struct Pshtv_Quad_Vert){ .pos = { x + w, y     }, .col = { pshtv_fill_color[0], pshtv_fill_color[1], pshtv_fill_color[2], pshtv_fill_color[3] }, .z = pshtv_z };
@@ -1101,6 +1272,141 @@ void fill_ellipse(float x, float y, float rx, float ry) {
 
     if (pshtv_ellipse_verts_len == PSHTV_ELLIPSE_VERTS_CAP) pshtv_flush_ellipses();
 }
+#else
+// Everything is drawn immediately into the backbuffer.
+void pshtv_flush_all() {}
+
+// The pixels covered by the parallelogram with corner ox, oy and sides
+// ux, uy and vx, vy after applying the transform matrix. A pixel px, py is at
+// u = iu[0] * px + iu[1] * py + iu[2] (and v likewise) along the sides, both
+// in [0, 1) when inside.
+struct Pshtv_Soft_Area {
+    int x1, y1, x2, y2;
+    float iu[3], iv[3];
+};
+
+int pshtv_soft_area(float ox, float oy, float ux, float uy, float vx, float vy, struct Pshtv_Soft_Area *a) {
+    float (*m)[4] = pshtv_transform_matrix;
+    const float b00 = m[0][0] * ux + m[0][1] * uy, b01 = m[0][0] * vx + m[0][1] * vy;
+    const float b10 = m[1][0] * ux + m[1][1] * uy, b11 = m[1][0] * vx + m[1][1] * vy;
+    const float b02 = m[0][0] * ox + m[0][1] * oy + m[0][3];
+    const float b12 = m[1][0] * ox + m[1][1] * oy + m[1][3];
+
+    const float det = b00 * b11 - b01 * b10;
+    if (det == 0 || !pshtv_pixels) return 0;
+
+    float min_x = b02 + fminf(0, b00) + fminf(0, b01), max_x = b02 + fmaxf(0, b00) + fmaxf(0, b01);
+    float min_y = b12 + fminf(0, b10) + fminf(0, b11), max_y = b12 + fmaxf(0, b10) + fmaxf(0, b11);
+    a->x1 = fmaxf(0, floorf(min_x)); a->x2 = fminf(pshtv_pixels_w, ceilf(max_x));
+    a->y1 = fmaxf(0, floorf(min_y)); a->y2 = fminf(pshtv_pixels_h, ceilf(max_y));
+    if (a->x1 >= a->x2 || a->y1 >= a->y2) return 0;
+
+    a->iu[0] =  b11 / det; a->iu[1] = -b01 / det; a->iu[2] = (b01 * b12 - b11 * b02) / det;
+    a->iv[0] = -b10 / det; a->iv[1] =  b00 / det; a->iv[2] = (b10 * b02 - b00 * b12) / det;
+    return 1;
+}
+
+uint32_t pshtv_pack_pixel(uint32_t r, uint32_t g, uint32_t b) {
+    return r << pshtv_red_shift | g << pshtv_green_shift | b << pshtv_blue_shift;
+}
+
+uint32_t pshtv_blend_pixel(uint32_t dst) {
+    const float a = pshtv_fill_color[3];
+    const uint32_t r = pshtv_fill_color[0] * 255.f * a + (dst >> pshtv_red_shift   & 0xff) * (1 - a);
+    const uint32_t g = pshtv_fill_color[1] * 255.f * a + (dst >> pshtv_green_shift & 0xff) * (1 - a);
+    const uint32_t b = pshtv_fill_color[2] * 255.f * a + (dst >> pshtv_blue_shift  & 0xff) * (1 - a);
+    return pshtv_pack_pixel(r, g, b);
+}
+
+void pshtv_soft_fill(float ox, float oy, float ux, float uy, float vx, float vy, int ellipse) {
+    struct Pshtv_Soft_Area a;
+    if (!pshtv_soft_area(ox, oy, ux, uy, vx, vy, &a)) return;
+
+    for (int py = a.y1; py < a.y2; ++py) {
+        uint32_t *row = pshtv_pixels + py * pshtv_pixels_stride;
+        for (int px = a.x1; px < a.x2; ++px) {
+            const float u = a.iu[0] * (px + .5f) + a.iu[1] * (py + .5f) + a.iu[2];
+            const float v = a.iv[0] * (px + .5f) + a.iv[1] * (py + .5f) + a.iv[2];
+            if (u < 0 || u >= 1 || v < 0 || v >= 1) continue;
+            if (ellipse && (2 * u - 1) * (2 * u - 1) + (2 * v - 1) * (2 * v - 1) > 1) continue;
+            row[px] = pshtv_blend_pixel(row[px]);
+        }
+    }
+}
+
+void draw_image_buffer(uint8_t *buffer, uint32_t img_w, uint32_t img_h, float x, float y, float w, float h) {
+    struct Pshtv_Soft_Area a;
+    if (!pshtv_soft_area(x, y, w, 0, 0, h, &a)) return;
+
+    if (a.iu[1] != 0 || a.iv[0] != 0) {
+        // Rotated, sample every pixel on its own
+        for (int py = a.y1; py < a.y2; ++py) {
+            uint32_t *row = pshtv_pixels + py * pshtv_pixels_stride;
+            for (int px = a.x1; px < a.x2; ++px) {
+                const float u = a.iu[0] * (px + .5f) + a.iu[1] * (py + .5f) + a.iu[2];
+                const float v = a.iv[0] * (px + .5f) + a.iv[1] * (py + .5f) + a.iv[2];
+                if (u < 0 || u >= 1 || v < 0 || v >= 1) continue;
+                const uint8_t *p = buffer + 4 * ((uint32_t)(v * img_h) * img_w + (uint32_t)(u * img_w));
+                row[px] = pshtv_pack_pixel(p[0], p[1], p[2]);
+            }
+        }
+        return;
+    }
+
+    // Axis aligned nearest-neighbour scaling. The source column of every
+    // window column is the same for all rows so we find them once.
+    static uint32_t *src_x;
+    static int src_x_cap;
+    if (src_x_cap < pshtv_pixels_w) {
+        src_x_cap = pshtv_pixels_w;
+        src_x = realloc(src_x, sizeof(*src_x) * src_x_cap);
+    }
+
+    int x1 = a.x2, x2 = a.x1;
+    for (int px = a.x1; px < a.x2; ++px) {
+        const float u = a.iu[0] * (px + .5f) + a.iu[2];
+        if (u < 0 || u >= 1) continue;
+        if (px < x1) x1 = px;
+        x2 = px + 1;
+        src_x[px] = 4 * (uint32_t)(u * img_w);
+    }
+
+    for (int py = a.y1; py < a.y2; ++py) {
+        const float v = a.iv[1] * (py + .5f) + a.iv[2];
+        if (v < 0 || v >= 1) continue;
+        const uint8_t *src = buffer + 4 * img_w * (uint32_t)(v * img_h);
+        uint32_t *row = pshtv_pixels + py * pshtv_pixels_stride;
+        for (int px = x1; px < x2; ++px) {
+            const uint8_t *p = src + src_x[px];
+            row[px] = pshtv_pack_pixel(p[0], p[1], p[2]);
+        }
+    }
+}
+
+void fill_rect(float x, float y, float w, float h) {
+    pshtv_soft_fill(x, y, w, 0, 0, h, 0);
+}
+
+void fill_line(float x1, float y1, float x2, float y2, float w) {
+    const float x0 = x2 - x1;
+    const float y0 = y2 - y1;
+    const float len = sqrt(x0 * x0 + y0 * y0);
+    const float x3 = w * .5 * -y0 / len;
+    const float y3 = w * .5 *  x0 / len;
+    pshtv_soft_fill(x1 - x3, y1 - y3, x0, y0, 2 * x3, 2 * y3, 0);
+}
+
+void fill_ellipse(float x, float y, float rx, float ry) {
+    pshtv_soft_fill(x - rx, y - ry, 2 * rx, 0, 0, 2 * ry, 1);
+}
+#endif
+
+void fill_color(uint32_t c) {
+    pshtv_fill_color[0] =     (c >> 16 & 0xff) / 255.f;
+    pshtv_fill_color[1] =     (c >>  8 & 0xff) / 255.f;
+    pshtv_fill_color[2] =     (c       & 0xff) / 255.f;
+    pshtv_fill_color[3] = 1 - (c >> 24 & 0xff) / 255.f;
+}
 
 void pshtv_mul_transform_matrix_by(float by[4][4]) {
     pshtv_flush_all();
@@ -1145,6 +1451,28 @@ void rotate(float a) {
     pshtv_mul_transform_matrix_by(rotate_matrix);
 }
 
+#ifdef PISHTOV_SOFTWARE
+void pshtv_redraw() {
+    if (pshtv_pixels_w != (int)window_w || pshtv_pixels_h != (int)window_h)
+        pshtv_resize_backbuffer(window_w, window_h);
+    if (!pshtv_pixels) return;
+
+    const uint32_t white = pshtv_pack_pixel(0xff, 0xff, 0xff);
+    for (int py = 0; py < pshtv_pixels_h; ++py)
+        for (int px = 0; px < pshtv_pixels_w; ++px)
+            pshtv_pixels[py * pshtv_pixels_stride + px] = white;
+
+    // We draw straight in window coordinates
+    for (int i = 0; i < 4; ++i)
+        for (int j = 0; j < 4; ++j)
+            pshtv_transform_matrix[i][j] = i == j ? 1 : 0;
+
+    pshtv_fill_color[0] = 0; pshtv_fill_color[1] = 0; pshtv_fill_color[2] = 1; pshtv_fill_color[3] = 1;
+
+    draw();
+    pshtv_swap_buffers();
+}
+#else
 void pshtv_redraw() {
     pglViewport(0, 0, window_w, window_h);
 
@@ -1178,20 +1506,46 @@ void pshtv_init_opengl() {
     pglEnable(GL_DEPTH_TEST);
     pglDepthFunc(GL_GEQUAL);
 }
+#endif
 
-// This part of Pishtov defines the main game loop.
-int main() {
-    pshtv_open_window("Igra", 800, 600);
+uint64_t pshtv_timestamp() {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// This part of Pishtov defines the main game loop. Define PISHTOV_NO_MAIN to
+// write your own main, e.g. to parse the command line, and call
+// pshtv_main_loop from it.
+void pshtv_main_loop(const char *name, int w, int h) {
+    pshtv_open_window(name, w, h);
+#ifndef PISHTOV_SOFTWARE
     pshtv_init_opengl();
+#endif
 
     init();
+
+    uint64_t next_frame_ts = pshtv_timestamp();
     while (1) {
         pshtv_handle_events();
         update();
         pshtv_redraw();
+
+        if (max_fps > 0) {
+            const uint64_t cur_ts = pshtv_timestamp();
+            next_frame_ts += 1000000000 / max_fps;
+            if (next_frame_ts > cur_ts) pshtv_sleep(next_frame_ts - cur_ts);
+            else next_frame_ts = cur_ts; // Too late, don't try to catch up
+        }
     }
 }
 
+#ifndef PISHTOV_NO_MAIN
+int main() {
+    pshtv_main_loop("Igra", 800, 600);
+}
+#endif
+
 #ifdef __cplusplus
 }
 #endif
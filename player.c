@@ -0,0 +1,129 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdbool.h>
+#define PISHTOV_NO_MAIN
+#include "pishtov.h"
+#include "recording.h"
+
+// Plays a recording written with `game -R PATH` without running the
+// simulation. Up and down change the speed, space pauses, left and right step
+// a frame, , and . seek by ten seconds and Home goes back to the start.
+
+struct Recording_Reader reader;
+float frames_per_second = 30;
+double position; // In frames
+bool paused;
+
+uint8_t *image;
+
+void print_position() {
+    const int64_t frame = position;
+    printf("frame %ld/%ld tick %lu\n", frame, recording_frames_len(&reader), reader.frames[frame].tick);
+}
+
+void seek_to(double frame) {
+    const int64_t last = recording_frames_len(&reader) - 1;
+    position = fmax(0, fmin(last, frame));
+}
+
+void init() {
+    image = malloc(4 * reader.header.field_w * reader.header.field_h);
+}
+
+void update() {
+    static uint64_t prev_ts;
+    const uint64_t cur_ts = pshtv_timestamp();
+    if (!prev_ts) prev_ts = cur_ts;
+    const double dt = (cur_ts - prev_ts) / 1e9;
+    prev_ts = cur_ts;
+
+    if (!paused) seek_to(position + dt * frames_per_second);
+    if (!recording_seek(&reader, position)) {
+        fprintf(stderr, "Could not read frame %ld\n", (int64_t)position);
+        exit(-1);
+    }
+
+    // Stop at the end
+    if (!paused && reader.frame == recording_frames_len(&reader) - 1) {
+        paused = true;
+        print_position();
+    }
+}
+
+void draw() {
+    const int64_t w = reader.header.field_w, h = reader.header.field_h;
+    for (int64_t i = 0; i < w * h; ++i) {
+        const uint32_t pixel = reader.pixels[i];
+        const uint32_t color = !pixel ? 0xffffff : RECORDING_SLEEPING(pixel) ? 0x808080 : RECORDING_COLOR(pixel);
+        image[4 * i + 0] = color >> 16 & 0xff;
+        image[4 * i + 1] = color >>  8 & 0xff;
+        image[4 * i + 2] = color       & 0xff;
+    }
+
+    const float zoom = fminf(window_w / w, window_h / h);
+    translate((window_w - w * zoom) / 2, (window_h - h * zoom) / 2);
+    scale(zoom, zoom);
+    draw_image_buffer(image, w, h, 0, 0, w, h);
+}
+
+void keydown(int key) {
+    switch (key) {
+    case 38:
+        frames_per_second *= 2.f;
+        printf("%g frames per second\n", frames_per_second);
+        break;
+    case 40:
+        frames_per_second *= .5f;
+        printf("%g frames per second\n", frames_per_second);
+        break;
+    case 0x20: // Space
+        paused = !paused;
+        if (paused) print_position();
+        else if (reader.frame == recording_frames_len(&reader) - 1) seek_to(0);
+        break;
+    case 37: // Left
+        paused = true;
+        seek_to(floor(position) - 1);
+        print_position();
+        break;
+    case 39: // Right
+        paused = true;
+        seek_to(floor(position) + 1);
+        print_position();
+        break;
+    case 0xbc: // ,
+        seek_to(position - frames_per_second * 10);
+        break;
+    case 0xbe: // .
+        seek_to(position + frames_per_second * 10);
+        break;
+    case 0x24: // Home
+        seek_to(0);
+        break;
+    }
+}
+
+void keyup(int key) {}
+void mousedown(int button) {}
+void mouseup(int button) {}
+
+int main(int argc, char **argv) {
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s RECORDING\n", argv[0]);
+        return -1;
+    }
+    if (!recording_open_reader(&reader, argv[1])) {
+        fprintf(stderr, "%s is not a recording\n", argv[1]);
+        return -1;
+    }
+    if (!recording_frames_len(&reader)) {
+        fprintf(stderr, "%s has no frames\n", argv[1]);
+        return -1;
+    }
+    printf("%ld frames of %ldx%ld\n", recording_frames_len(&reader), reader.header.field_w, reader.header.field_h);
+
+    pshtv_main_loop("Eco player", 800, 600);
+}
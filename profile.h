@@ -0,0 +1,168 @@
+#ifndef PROFILE_H_
+#define PROFILE_H_
+
+// Times phases of the hot path with the time stamp counter and keeps a
+// histogram per phase with a bucket for every power of two of cycles.
+//
+// Reading the counter is not free, e.g. about 20 ns in a VM. The cost of an
+// empty measurement is taken out of every duration and when profile_weight is
+// more than 1 only one in that many measurements is taken, standing in for
+// the rest.
+//
+// Only built with -DPROFILE, otherwise PROFILE_BEGIN and PROFILE_END are
+// empty and nothing here exists. Phases are numbered by the user, who passes
+// their names when printing.
+//
+// Every thread measures into phases of its own, which profile_print sums up,
+// so it must not run while other threads measure.
+
+#ifdef PROFILE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#define PROFILE_PHASES_MAX 16
+#define PROFILE_BUCKETS 64
+
+struct Profile_Phase {
+    uint64_t count;
+    uint64_t cycles;
+    uint64_t buckets[PROFILE_BUCKETS]; // Bucket b counts durations below 2^b cycles
+};
+
+// The phases of this thread, NULL until it measures something. They outlive
+// the thread so its measurements are still printed after it exits.
+_Thread_local struct Profile_Phase *profile_phases;
+
+// The phases of every thread that measured something
+struct Profile_Phase **profile_threads; // PROFILE_PHASES_MAX each
+int64_t profile_threads_len;
+pthread_mutex_t profile_threads_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// How many calls the next measurements of this thread stand for, 0 to not
+// measure
+_Thread_local uint64_t profile_weight = 1;
+uint64_t profile_overhead;
+
+// Without a time stamp counter the "cycles" are nanoseconds
+uint64_t profile_now() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+uint64_t profile_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void profile_register_thread() {
+    profile_phases = calloc(PROFILE_PHASES_MAX, sizeof(*profile_phases));
+    pthread_mutex_lock(&profile_threads_mutex);
+    profile_threads = realloc(profile_threads, sizeof(*profile_threads) * (profile_threads_len + 1));
+    profile_threads[profile_threads_len++] = profile_phases;
+    pthread_mutex_unlock(&profile_threads_mutex);
+}
+
+void profile_add(int phase, uint64_t cycles) {
+    if (!profile_phases) profile_register_thread();
+    struct Profile_Phase *p = profile_phases + phase;
+    cycles = cycles > profile_overhead ? cycles - profile_overhead : 0;
+    p->count += profile_weight;
+    p->cycles += cycles * profile_weight;
+    // 2^63 cycles and more, e.g. when the counter went back after moving to
+    // another CPU, would be bucket 64
+    const int bucket = cycles ? 64 - __builtin_clzll(cycles) : 0;
+    p->buckets[bucket < PROFILE_BUCKETS ? bucket : PROFILE_BUCKETS - 1] += profile_weight;
+}
+
+#define PROFILE_BEGIN(phase) const uint64_t profile_start_##phase = profile_weight ? profile_now() : 0
+#define PROFILE_END(phase) if (profile_weight) profile_add(phase, profile_now() - profile_start_##phase)
+
+// The counter ticks at a fixed rate, it is measured against the clock over
+// the whole run
+uint64_t profile_start_cycles, profile_start_ns;
+
+void profile_start() {
+    profile_overhead = UINT64_MAX;
+    for (int i = 0; i < 1000; ++i) {
+        const uint64_t start = profile_now();
+        const uint64_t cycles = profile_now() - start;
+        if (cycles < profile_overhead) profile_overhead = cycles;
+    }
+
+    profile_start_cycles = profile_now();
+    profile_start_ns = profile_ns();
+}
+
+// The upper bound of the bucket the given fraction of the durations falls in
+uint64_t profile_percentile(const struct Profile_Phase *p, double fraction) {
+    uint64_t seen = 0;
+    for (int b = 0; b < PROFILE_BUCKETS; ++b) {
+        seen += p->buckets[b];
+        if (seen >= fraction * p->count) return b < 63 ? 1ull << b : UINT64_MAX;
+    }
+    return UINT64_MAX;
+}
+
+void profile_print(FILE *f, const char **names, int phases_len, bool histograms) {
+    const double elapsed_ns = profile_ns() - profile_start_ns;
+    const double ns_per_cycle = elapsed_ns / (profile_now() - profile_start_cycles);
+
+    struct Profile_Phase phases[PROFILE_PHASES_MAX] = {};
+    pthread_mutex_lock(&profile_threads_mutex);
+    for (int64_t t = 0; t < profile_threads_len; ++t) {
+        for (int i = 0; i < phases_len; ++i) {
+            const struct Profile_Phase *p = profile_threads[t] + i;
+            phases[i].count += p->count;
+            phases[i].cycles += p->cycles;
+            for (int b = 0; b < PROFILE_BUCKETS; ++b) phases[i].buckets[b] += p->buckets[b];
+        }
+    }
+    pthread_mutex_unlock(&profile_threads_mutex);
+
+    fprintf(f, "%-28s %12s %10s %6s %9s %9s %9s\n", "phase", "calls", "total ms", "%", "mean ns", "p50 ns<", "p99 ns<");
+    for (int i = 0; i < phases_len; ++i) {
+        const struct Profile_Phase *p = phases + i;
+        if (!p->count) continue;
+        fprintf(f, "%-28s %12lu %10.1f %6.2f %9.1f %9.0f %9.0f\n",
+                names[i], p->count, p->cycles * ns_per_cycle / 1e6, 100 * p->cycles * ns_per_cycle / elapsed_ns,
+                p->cycles * ns_per_cycle / p->count,
+                profile_percentile(p, .5) * ns_per_cycle, profile_percentile(p, .99) * ns_per_cycle);
+    }
+
+    if (!histograms) return;
+    for (int i = 0; i < phases_len; ++i) {
+        const struct Profile_Phase *p = phases + i;
+        if (!p->count) continue;
+        uint64_t most = 0;
+        for (int b = 0; b < PROFILE_BUCKETS; ++b) if (p->buckets[b] > most) most = p->buckets[b];
+        fprintf(f, "%s\n", names[i]);
+        for (int b = 0; b < PROFILE_BUCKETS; ++b) {
+            if (!p->buckets[b]) continue;
+            const int bar = 50 * p->buckets[b] / most;
+            fprintf(f, "  < %12.0f ns %12lu %.*s\n", (b < 63 ? 1ull << b : UINT64_MAX) * ns_per_cycle, p->buckets[b],
+                    bar ? bar : 1, "##################################################");
+        }
+    }
+}
+
+#else
+
+#define PROFILE_BEGIN(phase)
+#define PROFILE_END(phase)
+
+#endif // PROFILE
+
+#endif // PROFILE_H_
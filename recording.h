@@ -0,0 +1,356 @@
+#ifndef RECORDING_H_
+#define RECORDING_H_
+
+// A compact recording of what the field looks like, frame by frame.
+//
+// A frame is one uint32_t per pixel, row by row. 0 is an empty pixel,
+// anything else is RECORDING_PIXEL of the cell on it.
+//
+// The file starts with a Recording_File_Header followed by frames. Every
+// frame is a Recording_Frame_Header and then that many bytes of LEB128
+// varints. Keyframes hold the number of occupied pixels and then for each of
+// them the count of empty pixels before it and its value - 1. Every other
+// frame only holds the pixels changed since the previous one as runs: the
+// count of unchanged pixels before the run, the length of the run and then
+// its new values. Every keyframe_interval-th frame is a keyframe, so players
+// can seek without decoding from the start.
+//
+// Frames are handed to a writer thread which encodes and writes them, so the
+// simulation doesn't wait on the disk. Unlike video.h no frame is skipped,
+// recording_begin_frame waits when all RECORDING_SLOTS are still full.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+#include "arr.h"
+
+#define RECORDING_MAGIC "ECOREEL"
+#define RECORDING_VERSION 1
+#define RECORDING_SLOTS 4
+
+#define RECORDING_PIXEL(color, sleeping) ((((color) & 0xffffff) | (uint32_t)(sleeping) << 24) + 1)
+#define RECORDING_COLOR(pixel) (((pixel) - 1) & 0xffffff)
+#define RECORDING_SLEEPING(pixel) ((((pixel) - 1) >> 24) & 1)
+
+struct Recording_File_Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t keyframe_interval;
+    int64_t field_w;
+    int64_t field_h;
+};
+
+struct Recording_Frame_Header {
+    uint32_t len;
+    uint32_t keyframe;
+    uint64_t tick;
+};
+
+struct Recording {
+    FILE *file;
+    int64_t w;
+    int64_t h;
+    uint32_t keyframe_interval;
+
+    pthread_t writer;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    bool closing;
+
+    // Slots are filled in order, the writer takes them in the same order
+    uint32_t *slots[RECORDING_SLOTS];
+    uint64_t ticks[RECORDING_SLOTS];
+    int64_t first_full;
+    int64_t full_len;
+
+    // Only the writer uses these, prev is what it last wrote
+    uint32_t *prev;
+    uint8_t *encoded;
+
+    uint64_t frames_written;
+    uint64_t bytes_written;
+};
+
+uint8_t *recording_put_varint(uint8_t *p, uint64_t v) {
+    while (v >= 0x80) {
+        *p++ = v | 0x80;
+        v >>= 7;
+    }
+    *p++ = v;
+    return p;
+}
+
+// Encodes and writes the frame in cur against prev, on the writer thread
+void recording_write_frame(struct Recording *r, const uint32_t *cur, uint64_t tick) {
+    const int64_t n = r->w * r->h;
+    const bool keyframe = r->frames_written % r->keyframe_interval == 0;
+    uint8_t *p = r->encoded;
+
+    if (keyframe) {
+        int64_t occupied = 0;
+        for (int64_t i = 0; i < n; ++i) occupied += cur[i] != 0;
+        p = recording_put_varint(p, occupied);
+        int64_t last = 0;
+        for (int64_t i = 0; i < n; ++i) {
+            if (!cur[i]) continue;
+            p = recording_put_varint(p, i - last);
+            p = recording_put_varint(p, cur[i] - 1);
+            last = i + 1;
+        }
+    } else {
+        int64_t last = 0;
+        for (int64_t i = 0; i < n; ) {
+            if (cur[i] == r->prev[i]) {
+                ++i;
+                continue;
+            }
+            int64_t end = i + 1;
+            while (end < n && cur[end] != r->prev[end]) ++end;
+            p = recording_put_varint(p, i - last);
+            p = recording_put_varint(p, end - i);
+            for (; i < end; ++i) p = recording_put_varint(p, cur[i]);
+            last = end;
+        }
+    }
+
+    struct Recording_Frame_Header header = {
+        .len = p - r->encoded,
+        .keyframe = keyframe,
+        .tick = tick,
+    };
+    if (fwrite(&header, sizeof(header), 1, r->file) != 1 ||
+        (header.len && fwrite(r->encoded, header.len, 1, r->file) != 1)) {
+        fprintf(stderr, "Could not write to the recording\n");
+    }
+    r->bytes_written += sizeof(header) + header.len;
+    ++r->frames_written;
+}
+
+void *recording_writer(void *arg) {
+    struct Recording *r = arg;
+
+    pthread_mutex_lock(&r->mutex);
+    while (1) {
+        while (!r->full_len && !r->closing) pthread_cond_wait(&r->cond, &r->mutex);
+        if (!r->full_len) break;
+        uint32_t *cur = r->slots[r->first_full];
+        const uint64_t tick = r->ticks[r->first_full];
+        pthread_mutex_unlock(&r->mutex);
+
+        recording_write_frame(r, cur, tick);
+
+        // The frame just written is what the next one is compared with, and
+        // the old prev takes its slot
+        pthread_mutex_lock(&r->mutex);
+        r->slots[r->first_full] = r->prev;
+        r->prev = cur;
+        r->first_full = (r->first_full + 1) % RECORDING_SLOTS;
+        --r->full_len;
+        pthread_cond_broadcast(&r->cond);
+    }
+    pthread_mutex_unlock(&r->mutex);
+
+    return NULL;
+}
+
+struct Recording *recording_open(const char *path, int64_t w, int64_t h, uint32_t keyframe_interval) {
+    FILE *f = fopen(path, "wb");
+    if (!f) return NULL;
+    setvbuf(f, NULL, _IOFBF, 1 << 20);
+
+    struct Recording_File_Header header = {
+        .magic = RECORDING_MAGIC,
+        .version = RECORDING_VERSION,
+        .keyframe_interval = keyframe_interval,
+        .field_w = w,
+        .field_h = h,
+    };
+    if (fwrite(&header, sizeof(header), 1, f) != 1) {
+        fclose(f);
+        return NULL;
+    }
+
+    struct Recording *r = calloc(1, sizeof(*r));
+    r->file = f;
+    r->w = w;
+    r->h = h;
+    r->keyframe_interval = keyframe_interval ? keyframe_interval : 1;
+    for (int64_t i = 0; i < RECORDING_SLOTS; ++i) r->slots[i] = malloc(sizeof(*r->slots[i]) * w * h);
+    r->prev = malloc(sizeof(*r->prev) * w * h);
+    // A lone changed pixel takes at most 3 varints of 5 bytes
+    r->encoded = malloc(15 * w * h + 10);
+    r->bytes_written = sizeof(header);
+
+    pthread_mutex_init(&r->mutex, NULL);
+    pthread_cond_init(&r->cond, NULL);
+    pthread_create(&r->writer, NULL, recording_writer, r);
+    return r;
+}
+
+// Returns the w * h pixels the caller should fill with the next frame, all of
+// them, as the slot still holds an older one
+uint32_t *recording_begin_frame(struct Recording *r) {
+    pthread_mutex_lock(&r->mutex);
+    while (r->full_len == RECORDING_SLOTS) pthread_cond_wait(&r->cond, &r->mutex);
+    uint32_t *slot = r->slots[(r->first_full + r->full_len) % RECORDING_SLOTS];
+    pthread_mutex_unlock(&r->mutex);
+    return slot;
+}
+
+void recording_end_frame(struct Recording *r, uint64_t tick) {
+    pthread_mutex_lock(&r->mutex);
+    r->ticks[(r->first_full + r->full_len) % RECORDING_SLOTS] = tick;
+    ++r->full_len;
+    pthread_cond_broadcast(&r->cond);
+    pthread_mutex_unlock(&r->mutex);
+}
+
+// Writes out the frames still waiting and closes the file. r itself is left
+// to the caller to free, so its counts can still be read.
+void recording_close(struct Recording *r) {
+    pthread_mutex_lock(&r->mutex);
+    r->closing = true;
+    pthread_cond_broadcast(&r->cond);
+    pthread_mutex_unlock(&r->mutex);
+    pthread_join(r->writer, NULL);
+
+    fclose(r->file);
+    for (int64_t i = 0; i < RECORDING_SLOTS; ++i) free(r->slots[i]);
+    free(r->prev);
+    free(r->encoded);
+    pthread_mutex_destroy(&r->mutex);
+    pthread_cond_destroy(&r->cond);
+}
+
+// Reading it back
+
+struct Recording_Index_Entry {
+    int64_t offset; // Of the frame header in the file
+    uint64_t tick;
+    bool keyframe;
+};
+
+struct Recording_Reader {
+    FILE *file;
+    struct Recording_File_Header header;
+    struct Recording_Index_Entry *frames; // arr
+    uint32_t *pixels;
+    int64_t frame; // The frame in pixels, -1 before the first one
+    uint8_t *data;
+    int64_t data_cap;
+};
+
+// Reads the frame headers up front so any frame can be found without
+// decoding the ones before it
+bool recording_open_reader(struct Recording_Reader *r, const char *path) {
+    r->file = fopen(path, "rb");
+    if (!r->file) return false;
+    if (fread(&r->header, sizeof(r->header), 1, r->file) != 1 ||
+        memcmp(r->header.magic, RECORDING_MAGIC, sizeof(r->header.magic)) ||
+        r->header.version != RECORDING_VERSION ||
+        r->header.field_w <= 0 || r->header.field_h <= 0) {
+        fclose(r->file);
+        return false;
+    }
+
+    r->frames = arr_create(struct Recording_Index_Entry);
+    struct Recording_Frame_Header h;
+    int64_t offset = sizeof(r->header);
+    while (fread(&h, sizeof(h), 1, r->file) == 1) {
+        // A keyframe is needed to start from
+        if (arr_len(r->frames) || h.keyframe) {
+            arr_push(&r->frames, ((struct Recording_Index_Entry){ offset, h.tick, h.keyframe }));
+        }
+        offset += sizeof(h) + h.len;
+        if (fseek(r->file, offset, SEEK_SET)) break;
+    }
+
+    r->pixels = calloc(r->header.field_w * r->header.field_h, sizeof(*r->pixels));
+    r->frame = -1;
+    r->data = NULL;
+    r->data_cap = 0;
+    return true;
+}
+
+int64_t recording_frames_len(struct Recording_Reader *r) {
+    return arr_len(r->frames);
+}
+
+uint64_t recording_get_varint(const uint8_t **p, const uint8_t *end) {
+    uint64_t v = 0;
+    for (int shift = 0; *p < end; shift += 7) {
+        const uint8_t byte = *(*p)++;
+        v |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) break;
+    }
+    return v;
+}
+
+bool recording_decode_frame(struct Recording_Reader *r, int64_t frame) {
+    struct Recording_Frame_Header h;
+    if (fseek(r->file, r->frames[frame].offset, SEEK_SET) ||
+        fread(&h, sizeof(h), 1, r->file) != 1) {
+        return false;
+    }
+    if (r->data_cap < h.len) {
+        r->data_cap = h.len;
+        r->data = realloc(r->data, r->data_cap);
+    }
+    if (h.len && fread(r->data, h.len, 1, r->file) != 1) {
+        fprintf(stderr, "The recording is truncated\n");
+        return false;
+    }
+
+    const int64_t n = r->header.field_w * r->header.field_h;
+    const uint8_t *p = r->data, *end = r->data + h.len;
+    int64_t i = 0;
+    if (h.keyframe) {
+        memset(r->pixels, 0, sizeof(*r->pixels) * n);
+        for (uint64_t left = recording_get_varint(&p, end); left && p < end; --left) {
+            i += recording_get_varint(&p, end);
+            if (i >= n) return false;
+            r->pixels[i++] = recording_get_varint(&p, end) + 1;
+        }
+    } else {
+        while (p < end) {
+            i += recording_get_varint(&p, end);
+            const int64_t len = recording_get_varint(&p, end);
+            if (i + len > n) return false;
+            for (int64_t j = 0; j < len; ++j) r->pixels[i++] = recording_get_varint(&p, end);
+        }
+    }
+
+    r->frame = frame;
+    return true;
+}
+
+// Leaves the pixels of the given frame in r->pixels. Going forward only
+// decodes the frames in between, anything else starts from a keyframe.
+bool recording_seek(struct Recording_Reader *r, int64_t frame) {
+    if (frame < 0 || frame >= arr_len(r->frames)) return false;
+    if (frame == r->frame) return true;
+
+    int64_t from = frame;
+    while (!r->frames[from].keyframe) --from;
+    if (r->frame >= from && r->frame < frame) from = r->frame + 1;
+
+    for (int64_t i = from; i <= frame; ++i) {
+        if (!recording_decode_frame(r, i)) {
+            r->frame = -1;
+            return false;
+        }
+    }
+    return true;
+}
+
+void recording_close_reader(struct Recording_Reader *r) {
+    fclose(r->file);
+    arr_free(r->frames);
+    free(r->pixels);
+    free(r->data);
+}
+
+#endif // RECORDING_H_
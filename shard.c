@@ -0,0 +1,308 @@
+// Runs one field as several processes, each owning a strip of its columns, so
+// a field too big for the memory bandwidth of one core is shared between many.
+//
+// A shard is an ordinary world whose field is its strip with a column of
+// ghosts on either side, mirroring the edge columns of the neighbouring
+// shards. The shards take turns in rounds. In every round a shard publishes
+// its edge columns and the cells that stepped onto its ghosts to the
+// neighbours, waits for theirs, copies their edges into its ghosts, places
+// the cells they sent and runs a sweep. Everything a shard looks at was
+// published at the end of the same round, so sensors at the edges always see
+// a whole column from one moment, one sweep behind. A cell stepping across
+// lands at the start of the next round and eats or is eaten there.
+//
+// The exchange is through POSIX shared memory. Every shard has an outbox per
+// side and per parity of the round: a shard only writes one of the two while
+// its neighbours read the other, so nothing is ever torn.
+//
+// The run is deterministic for a given number of shards, but not the same as
+// running the whole field in one process, as cells near the edges see their
+// neighbours a sweep late, and every shard spawns a cell per sweep.
+
+#define main eco_main
+#include "game.c"
+#undef main
+
+#include <sched.h>
+#include <signal.h>
+#include <stdatomic.h>
+
+enum { SHARD_LEFT, SHARD_RIGHT };
+
+struct Shard_Ghost {
+    uint32_t color;
+    float energy;
+    uint8_t occupied;
+    uint8_t sleeping;
+};
+
+struct Shard_Status {
+    atomic_uint_fast64_t rounds; // Published so far
+
+    // Written at the end
+    int64_t population;
+    uint64_t ticks;
+    uint64_t hash;
+    uint64_t migrants_sent;
+    double busy_seconds;
+    double wait_seconds;
+} __attribute__((aligned(64)));
+
+int64_t shards_len = 2;
+int64_t global_w;
+
+// Of the shard this process runs
+int64_t shard_id;
+int64_t shard_x0; // Global column of local column 1
+int64_t strip_w;
+uint64_t shard_round;
+struct Cell *ghosts; // field_h on the left, then field_h on the right
+
+uint8_t *shard_memory;
+int64_t outbox_size;
+
+struct Shard_Status *shard_status(int64_t shard) {
+    return (struct Shard_Status *)shard_memory + shard;
+}
+
+// An outbox is field_h ghosts, the number of migrants and room for field_h
+// of them, that being the most cells that can step off one edge in a sweep
+uint8_t *outbox(int64_t shard, int side, uint64_t round) {
+    return shard_memory + sizeof(struct Shard_Status) * shards_len +
+           outbox_size * ((shard * 2 + side) * 2 + round % 2);
+}
+
+struct Shard_Ghost *outbox_edge(uint8_t *box) {
+    return (struct Shard_Ghost *)box;
+}
+
+uint64_t *outbox_migrants_len(uint8_t *box) {
+    return (uint64_t *)(box + sizeof(struct Shard_Ghost) * field_h);
+}
+
+uint8_t *outbox_migrant(uint8_t *box, uint64_t i) {
+    return (uint8_t *)(outbox_migrants_len(box) + 1) + cell_record_size() * i;
+}
+
+int64_t shard_start(int64_t shard) {
+    return shard * global_w / shards_len;
+}
+
+void shard_hand_off(struct Cell *c) {
+    const int side = c->x == 0 ? SHARD_LEFT : SHARD_RIGHT;
+    uint8_t *box = outbox(shard_id, side, shard_round + 1);
+    uint64_t *len = outbox_migrants_len(box);
+
+    struct Cell_Record r;
+    cell_to_record(c, &r);
+    r.x = side == SHARD_LEFT ? mod(shard_x0 - 1, global_w) : mod(shard_x0 + strip_w, global_w);
+    memcpy(outbox_migrant(box, (*len)++), &r, cell_record_size());
+    ++shard_status(shard_id)->migrants_sent;
+    free_cell(&cell_arena, c);
+}
+
+void publish_round() {
+    for (int side = SHARD_LEFT; side <= SHARD_RIGHT; ++side) {
+        struct Shard_Ghost *edge = outbox_edge(outbox(shard_id, side, shard_round));
+        const int64_t x = side == SHARD_LEFT ? 1 : strip_w;
+        for (int64_t y = 0; y < field_h; ++y) {
+            const struct Cell *c = FIELD(x, y);
+            edge[y] = c ? (struct Shard_Ghost){ c->color, c->energy, 1, c->sleeping } : (struct Shard_Ghost){};
+        }
+    }
+    atomic_store_explicit(&shard_status(shard_id)->rounds, shard_round + 1, memory_order_release);
+}
+
+void wait_for_round(int64_t shard) {
+    while (atomic_load_explicit(&shard_status(shard)->rounds, memory_order_acquire) <= shard_round) sched_yield();
+}
+
+// From the outbox the neighbour on the given side filled for us
+void receive_round(int side) {
+    const int64_t neighbour = mod(shard_id + (side == SHARD_LEFT ? -1 : 1), shards_len);
+    uint8_t *box = outbox(neighbour, side == SHARD_LEFT ? SHARD_RIGHT : SHARD_LEFT, shard_round);
+
+    const struct Shard_Ghost *edge = outbox_edge(box);
+    const int64_t x = side == SHARD_LEFT ? 0 : strip_w + 1;
+    struct Cell *column = ghosts + (side == SHARD_LEFT ? 0 : field_h);
+    for (int64_t y = 0; y < field_h; ++y) {
+        struct Cell *g = column + y;
+        g->x = x;
+        g->y = y;
+        g->color = edge[y].color;
+        g->energy = edge[y].energy;
+        g->sleeping = edge[y].sleeping;
+        FIELD(x, y) = edge[y].occupied ? g : NULL;
+    }
+
+    const uint64_t len = *outbox_migrants_len(box);
+    for (uint64_t i = 0; i < len; ++i) {
+        struct Cell_Record r;
+        memcpy(&r, outbox_migrant(box, i), cell_record_size());
+        struct Cell *c = alloc_cell(&cell_arena);
+        cell_from_record(c, &r);
+        c->x = mod(r.x - shard_x0, global_w) + 1;
+        species_add(c);
+        place_on_field_or_die(c);
+    }
+}
+
+void run_shard(uint64_t seed, uint64_t sweeps) {
+    struct Shard_Status *status = shard_status(shard_id);
+    const int64_t left = mod(shard_id - 1, shards_len), right = mod(shard_id + 1, shards_len);
+
+    shard_x0 = shard_start(shard_id);
+    strip_w = shard_start(shard_id + 1) - shard_x0;
+    const int64_t cells = initial_cells_len * strip_w / global_w;
+    field_w = strip_w + 2;
+    init_world();
+    ghosts = calloc(2 * field_h, sizeof(*ghosts));
+    hand_off = shard_hand_off;
+
+    seed_rand64(seed + shard_id);
+    for (int64_t i = 0; i < cells; ++i) create_random_cell();
+
+    for (shard_round = 0; ; ++shard_round) {
+        publish_round();
+
+        double start = get_timestamp() / 1e9;
+        wait_for_round(left);
+        wait_for_round(right);
+        status->wait_seconds += get_timestamp() / 1e9 - start;
+
+        start = get_timestamp() / 1e9;
+        receive_round(SHARD_LEFT);
+        receive_round(SHARD_RIGHT);
+        if (shard_round == sweeps) break;
+
+        *outbox_migrants_len(outbox(shard_id, SHARD_LEFT, shard_round + 1)) = 0;
+        *outbox_migrants_len(outbox(shard_id, SHARD_RIGHT, shard_round + 1)) = 0;
+        do do_tick(); while (tick_cursor);
+        status->busy_seconds += get_timestamp() / 1e9 - start;
+    }
+
+    // In global columns, so the hashes of all shards make up the whole field
+    uint64_t h = 0xcbf29ce484222325;
+    for (struct Cell *it = cell_arena.head; it; it = it->next) {
+        struct Cell_Record r;
+        cell_to_record(it, &r);
+        r.x = shard_x0 + it->x - 1;
+        h = hash_bytes(h, &r, cell_record_size());
+    }
+    status->population = cell_arena.len;
+    status->ticks = tick_count;
+    status->hash = h;
+}
+
+void shard_usage(const char *name) {
+    eprintf("Usage: %s [options]\n", name);
+    eprintf("    -N SHARDS  Processes to split the field between (default 2)\n");
+    eprintf("    -g WxH     Size of the whole field (default %dx%d)\n", FIELD_W, FIELD_H);
+    eprintf("    -i CELLS   Random cells to start with on the whole field (default %d)\n", INITIAL_CELLS_LEN);
+    eprintf("    -l COUNT   Synapses of every cell (default %d)\n", SYNAPSES_LEN);
+    eprintf("    -s SEED    Seed of the first shard, the others take the next ones (default 1)\n");
+    eprintf("    -n SWEEPS  Sweeps to run (default 100)\n");
+    eprintf("    -U         Don't pin the shards to CPUs\n");
+    exit(-1);
+}
+
+int main(int argc, char **argv) {
+    uint64_t seed = 1;
+    uint64_t sweeps = 100;
+    bool pin = true;
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "-N") && i + 1 < argc) shards_len = atoll(argv[++i]);
+        else if (!strcmp(argv[i], "-g") && i + 1 < argc) { if (!parse_size(argv[++i], &field_w, &field_h)) shard_usage(argv[0]); }
+        else if (!strcmp(argv[i], "-i") && i + 1 < argc) initial_cells_len = atoll(argv[++i]);
+        else if (!strcmp(argv[i], "-l") && i + 1 < argc) synapses_len = atoll(argv[++i]);
+        else if (!strcmp(argv[i], "-s") && i + 1 < argc) seed = atoll(argv[++i]);
+        else if (!strcmp(argv[i], "-n") && i + 1 < argc) sweeps = atoll(argv[++i]);
+        else if (!strcmp(argv[i], "-U")) pin = false;
+        else shard_usage(argv[0]);
+    }
+    global_w = field_w;
+    if (shards_len < 1 || shards_len > global_w || field_h < 1 || synapses_len < 0 || synapses_len > SYNAPSES_MAX ||
+        initial_cells_len < 0 || initial_cells_len > global_w * field_h) {
+        shard_usage(argv[0]);
+    }
+
+    outbox_size = sizeof(struct Shard_Ghost) * field_h + sizeof(uint64_t) + cell_record_size() * field_h;
+    outbox_size = (outbox_size + 63) / 64 * 64;
+    const int64_t memory_size = sizeof(struct Shard_Status) * shards_len + outbox_size * shards_len * 4;
+
+    // The name is only needed until the mapping is made, the shards inherit it
+    char name[64];
+    snprintf(name, sizeof(name), "/eco-shard-%d", getpid());
+    const int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0 || ftruncate(fd, memory_size)) {
+        eprintf("Could not create the shared memory %s\n", name);
+        return -1;
+    }
+    shard_memory = mmap(NULL, memory_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    shm_unlink(name);
+    if (shard_memory == MAP_FAILED) {
+        eprintf("Could not map the shared memory\n");
+        return -1;
+    }
+
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    sched_getaffinity(0, sizeof(allowed), &allowed);
+    int *cpus = arr_create(int);
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) if (CPU_ISSET(cpu, &allowed)) arr_push(&cpus, cpu);
+
+    const uint64_t start = get_timestamp();
+    pid_t *pids = calloc(shards_len, sizeof(*pids));
+    for (int64_t i = 0; i < shards_len; ++i) {
+        fflush(stdout);
+        pids[i] = fork();
+        if (pids[i] < 0) {
+            eprintf("Could not start shard %ld\n", i);
+            return -1;
+        }
+        if (!pids[i]) {
+            if (pin && arr_len(cpus)) {
+                cpu_set_t set;
+                CPU_ZERO(&set);
+                CPU_SET(cpus[i % arr_len(cpus)], &set);
+                sched_setaffinity(0, sizeof(set), &set);
+            }
+            shard_id = i;
+            run_shard(seed, sweeps);
+            _exit(0);
+        }
+    }
+
+    // A shard that dies would leave its neighbours waiting forever
+    bool ok = true;
+    for (int64_t left = shards_len; left > 0; --left) {
+        int status;
+        const pid_t pid = wait(&status);
+        if (pid > 0 && WIFEXITED(status) && !WEXITSTATUS(status)) continue;
+        eprintf("A shard failed\n");
+        for (int64_t i = 0; i < shards_len; ++i) kill(pids[i], SIGKILL);
+        ok = false;
+        break;
+    }
+    if (!ok) return -1;
+    const double seconds = (get_timestamp() - start) / 1e9;
+
+    printf("%ldx%ld in %ld shards, seed %lu, %lu sweeps, %.3f s\n", global_w, field_h, shards_len, seed, sweeps, seconds);
+    printf("%6s %12s %10s %12s %10s %8s %8s %16s\n", "shard", "columns", "cells", "ticks", "migrants", "busy s", "wait s", "hash");
+    uint64_t h = 0xcbf29ce484222325, ticks = 0;
+    int64_t population = 0;
+    for (int64_t i = 0; i < shards_len; ++i) {
+        const struct Shard_Status *s = shard_status(i);
+        char columns[32];
+        snprintf(columns, sizeof(columns), "%ld-%ld", shard_start(i), shard_start(i + 1) - 1);
+        printf("%6ld %12s %10ld %12lu %10lu %8.3f %8.3f %016lx\n",
+               i, columns, s->population, s->ticks, s->migrants_sent, s->busy_seconds, s->wait_seconds, s->hash);
+        h = hash_bytes(h, &s->hash, sizeof(s->hash));
+        ticks += s->ticks;
+        population += s->population;
+    }
+    printf("%6s %12s %10ld %12lu %10s %8s %8s %016lx\n", "all", "", population, ticks, "", "", "", h);
+    printf("%.0f updates/s\n", ticks / seconds);
+    return 0;
+}
@@ -0,0 +1,453 @@
+// Runs one world on several threads, by cutting its field into tiles.
+//
+// A sweep goes over the tiles in four phases, one for every parity of the
+// tile's column and row. The tiles of a phase are a whole tile apart, and a
+// cell only ever looks at, moves onto or gives birth on the positions next to
+// it, so the cells of two tiles of a phase never meet and the tiles can be
+// updated at the same time. Every tile updates the cells that were on it when
+// the sweep started, in list order, with random numbers of its own.
+//
+// Populations cluster, so a few tiles hold most of the cells and splitting
+// the field evenly would leave most threads waiting for the one with the
+// crowd. Instead the tiles of a phase are dealt out by how many cells they
+// have, the fullest first and each to the thread with the least cells so
+// far. Every thread has a deque of tiles it works through from the bottom,
+// and when it runs out it steals from the top of another's.
+//
+// The run is deterministic and the same on any number of threads, but not
+// the same as running the world in game, as the cells are updated tile by
+// tile instead of in list order.
+//
+// Every thread also owns a strip of tile columns, whose part of the field,
+// the occupancy bits and the tasks it touches first, so on a NUMA machine the
+// pages end up on its node. Only with -S does it then update just the tiles
+// of its strip. Otherwise tiles go to whichever thread has the fewest cells
+// and get stolen, so threads mostly work on pages another one placed, and
+// NUMA placement is lost. Use -S where it matters.
+
+#define TILED_SWEEPS
+#define main eco_main
+#include "game.c"
+#undef main
+
+#include <sched.h>
+#include <pthread.h>
+
+struct Tiled_Task {
+    uint64_t seed;
+    struct Cell **cells; // arr, the cells on the tile when the sweep started
+    struct Cell **born;  // arr
+    struct Cell **dead;  // arr
+    uint64_t updates;
+};
+
+struct Tiled_Deque {
+    pthread_mutex_t mutex;
+    int64_t *tasks; // A ring of indices into tiled_tasks
+    int64_t top;
+    int64_t len;
+};
+
+struct Tiled_Worker {
+    pthread_t thread;
+    int64_t id;
+    int cpu; // -1 when not pinned
+    int64_t first_column; // The strip of tile columns it owns
+    int64_t end_column;
+    struct Tiled_Deque deque;
+    int64_t load; // Cells dealt to it in this phase
+
+    uint64_t tasks;
+    uint64_t steals;
+    uint64_t updates;
+    double busy_seconds;
+    struct Telemetry_Counters counters;
+} __attribute__((aligned(64))); // Threads don't share cache lines
+
+int64_t tiles_x;
+int64_t tiles_y;
+int32_t *column_tile; // The tile column of every field column
+int32_t *row_tile;
+struct Tiled_Task *tiled_tasks;
+int64_t tiled_tasks_len;
+
+struct Tiled_Worker *tiled_workers;
+int64_t tiled_workers_len;
+bool tiled_static; // Split the tiles evenly by area and don't steal
+bool tiled_stop;
+pthread_barrier_t phase_start;
+pthread_barrier_t phase_end;
+pthread_mutex_t arena_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+double tiled_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+struct Cell *tiled_alloc_cell(struct Cell_Arena *ca) {
+    pthread_mutex_lock(&arena_mutex);
+    struct Cell *new = take_slot(ca);
+    pthread_mutex_unlock(&arena_mutex);
+    new->next = NULL;
+    new->prev = NULL;
+    arr_push(&tiled_task->born, new);
+    return new;
+}
+
+// The slot stays taken until the sweep is over, so a cell still waiting for
+// its update can't be confused with one born in its slot
+void tiled_free_cell(struct Cell *c) {
+    arr_push(&tiled_task->dead, c);
+}
+
+// Every deque has room for all the tasks
+void tiled_push_bottom(struct Tiled_Deque *d, int64_t task) {
+    pthread_mutex_lock(&d->mutex);
+    d->tasks[(d->top + d->len++) % tiled_tasks_len] = task;
+    pthread_mutex_unlock(&d->mutex);
+}
+
+bool tiled_pop_bottom(struct Tiled_Deque *d, int64_t *task) {
+    pthread_mutex_lock(&d->mutex);
+    const bool ok = d->len > 0;
+    if (ok) *task = d->tasks[(d->top + --d->len) % tiled_tasks_len];
+    pthread_mutex_unlock(&d->mutex);
+    return ok;
+}
+
+bool tiled_steal_top(struct Tiled_Deque *d, int64_t *task) {
+    pthread_mutex_lock(&d->mutex);
+    const bool ok = d->len > 0;
+    if (ok) {
+        *task = d->tasks[d->top];
+        d->top = (d->top + 1) % tiled_tasks_len;
+        --d->len;
+    }
+    pthread_mutex_unlock(&d->mutex);
+    return ok;
+}
+
+// Nothing is dealt during a phase, so when every deque is empty the phase is
+// done. Tries the next threads first, so thieves spread over the victims.
+bool find_task(struct Tiled_Worker *me, int64_t *task) {
+    if (tiled_pop_bottom(&me->deque, task)) return true;
+    if (tiled_static) return false;
+    for (int64_t i = 1; i < tiled_workers_len; ++i) {
+        struct Tiled_Worker *victim = tiled_workers + (me->id + i) % tiled_workers_len;
+        if (tiled_steal_top(&victim->deque, task)) {
+            ++me->steals;
+            return true;
+        }
+    }
+    return false;
+}
+
+uint64_t splitmix64(uint64_t *x) {
+    uint64_t z = (*x += 0x9e3779b97f4a7c15);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+    return z ^ (z >> 31);
+}
+
+void run_task(struct Tiled_Task *t) {
+    tiled_task = t;
+    uint64_t s = t->seed;
+    xorshf_x = splitmix64(&s) | 1;
+    xorshf_y = splitmix64(&s);
+    xorshf_z = splitmix64(&s);
+
+    for (int64_t i = 0; i < arr_len(t->cells); ++i) {
+        struct Cell *c = t->cells[i];
+        // Eaten earlier in the sweep
+        if (FIELD(c->x, c->y) != c) continue;
+        update_cell(c);
+        ++t->updates;
+    }
+    tiled_task = NULL;
+}
+
+// The share of len things of the given size at p that is thread id's
+void touch_share(void *p, int64_t size, int64_t len, int64_t id) {
+    const int64_t from = id * len / tiled_workers_len, to = (id + 1) * len / tiled_workers_len;
+    memset((uint8_t *)p + from * size, 0, (to - from) * size);
+}
+
+// The field, the occupancy bits and the tasks are in columns, so those of the
+// strip are in one piece. The pixels and the mips are row by row and every
+// strip has a part of every row, so like the arena slots of the first cells
+// they are shared out evenly instead, which at least keeps the nodes even.
+void first_touch(struct Tiled_Worker *me) {
+    int64_t from = 0, to = 0;
+    while (from < field_w && column_tile[from] < me->first_column) ++from;
+    for (to = from; to < field_w && column_tile[to] < me->end_column; ++to);
+    memset(field + from * field_h, 0, (to - from) * field_h * sizeof(*field));
+    // A word split between two strips goes to the one it starts in
+    const int64_t first_word = (from * field_h + 63) >> 6, end_word = (to * field_h + 63) >> 6;
+    memset(occupancy + first_word, 0, (end_word - first_word) * sizeof(*occupancy));
+
+    for (int64_t i = me->first_column * tiles_y; i < me->end_column * tiles_y; ++i) {
+        struct Tiled_Task *t = tiled_tasks + i;
+        memset(t, 0, sizeof(*t));
+        t->cells = arr_create(struct Cell *);
+        t->born = arr_create(struct Cell *);
+        t->dead = arr_create(struct Cell *);
+    }
+
+    touch_share(pixels, field_w * sizeof(*pixels), field_h, me->id);
+    for (int64_t l = 0; l < MIP_LEVELS; ++l) touch_share(mip[l], mip_w[l] * sizeof(*mip[l]), mip_h[l], me->id);
+    touch_share(cell_arena.data, cell_arena.stride, initial_cells_len, me->id);
+}
+
+void *tiled_worker(void *arg) {
+    struct Tiled_Worker *me = arg;
+    if (me->cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(me->cpu, &set);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set)) {
+            eprintf("Could not pin thread %ld to CPU %d\n", me->id, me->cpu);
+            me->cpu = -1;
+        }
+    }
+    // Taken here so its pages are on the node of the thread
+    me->deque.tasks = malloc(sizeof(*me->deque.tasks) * tiled_tasks_len);
+    first_touch(me);
+    pthread_barrier_wait(&phase_end);
+
+    while (true) {
+        pthread_barrier_wait(&phase_start);
+        if (tiled_stop) break;
+
+        const double start = tiled_now();
+        int64_t i;
+        while (find_task(me, &i)) {
+            struct Tiled_Task *t = tiled_tasks + i;
+            const uint64_t updates = t->updates;
+            run_task(t);
+            me->updates += t->updates - updates;
+            ++me->tasks;
+        }
+        me->busy_seconds += tiled_now() - start;
+        pthread_barrier_wait(&phase_end);
+    }
+    me->counters = telemetry_counters;
+    return NULL;
+}
+
+int compare_task_cells(const void *a, const void *b) {
+    const int64_t la = arr_len(tiled_tasks[*(const int64_t *)a].cells);
+    const int64_t lb = arr_len(tiled_tasks[*(const int64_t *)b].cells);
+    if (la != lb) return la < lb ? 1 : -1;
+    return *(const int64_t *)a < *(const int64_t *)b ? -1 : 1;
+}
+
+// order and order_worker have room for every task
+void deal_phase(int64_t phase, int64_t *order, int64_t *order_worker) {
+    int64_t len = 0;
+    for (int64_t ty = phase >> 1; ty < tiles_y; ty += 2) {
+        for (int64_t tx = phase & 1; tx < tiles_x; tx += 2) {
+            const int64_t i = tx * tiles_y + ty;
+            if (arr_len(tiled_tasks[i].cells)) order[len++] = i;
+        }
+    }
+
+    for (int64_t w = 0; w < tiled_workers_len; ++w) tiled_workers[w].load = 0;
+    if (tiled_static) {
+        for (int64_t i = len - 1; i >= 0; --i) tiled_push_bottom(&tiled_workers[order[i] / tiles_y * tiled_workers_len / tiles_x].deque, order[i]);
+        return;
+    }
+
+    qsort(order, len, sizeof(*order), compare_task_cells);
+    for (int64_t i = 0; i < len; ++i) {
+        int64_t least = 0;
+        for (int64_t w = 1; w < tiled_workers_len; ++w) {
+            if (tiled_workers[w].load < tiled_workers[least].load) least = w;
+        }
+        tiled_workers[least].load += arr_len(tiled_tasks[order[i]].cells);
+        order_worker[i] = least;
+    }
+    // Pushed emptiest first, so owners start on their fullest tiles and
+    // thieves take the small ones left at the end
+    for (int64_t i = len - 1; i >= 0; --i) tiled_push_bottom(&tiled_workers[order_worker[i]].deque, order[i]);
+}
+
+void tiled_sweep(int64_t *order, int64_t *order_worker) {
+    create_random_cell();
+
+    for (int64_t i = 0; i < tiled_tasks_len; ++i) {
+        struct Tiled_Task *t = tiled_tasks + i;
+        // arr_resize can't shrink to nothing
+        ARR_LEN(t->cells) = 0;
+        ARR_LEN(t->born) = 0;
+        ARR_LEN(t->dead) = 0;
+        t->updates = 0;
+    }
+    const uint64_t sweep_seed = rand64();
+    for (struct Cell *it = cell_arena.head; it; it = it->next) {
+        struct Tiled_Task *t = tiled_tasks + column_tile[it->x] * tiles_y + row_tile[it->y];
+        arr_push(&t->cells, it);
+    }
+    for (int64_t i = 0; i < tiled_tasks_len; ++i) tiled_tasks[i].seed = sweep_seed ^ i * 0xd1342543de82ef95;
+
+    for (int64_t phase = 0; phase < 4; ++phase) {
+        deal_phase(phase, order, order_worker);
+        pthread_barrier_wait(&phase_start);
+        pthread_barrier_wait(&phase_end);
+    }
+
+    // The children are linked in before anyone is freed, as some of them
+    // have died already
+    for (int64_t i = 0; i < tiled_tasks_len; ++i) {
+        struct Tiled_Task *t = tiled_tasks + i;
+        for (int64_t j = 0; j < arr_len(t->born); ++j) {
+            struct Cell *c = t->born[j];
+            c->next = cell_arena.head;
+            if (c->next) c->next->prev = c;
+            cell_arena.head = c;
+            species_add(c);
+        }
+        tick_count += t->updates;
+    }
+    for (int64_t i = 0; i < tiled_tasks_len; ++i) {
+        struct Tiled_Task *t = tiled_tasks + i;
+        for (int64_t j = 0; j < arr_len(t->dead); ++j) free_cell(&cell_arena, t->dead[j]);
+    }
+}
+
+// Tiles of about tile columns, an even number of them so the phases still
+// alternate across the wrap, and at least two wide so the cells of tiles two
+// apart can't meet
+bool cut_into_tiles(int32_t **of, int64_t len, int64_t tile, int64_t *tiles) {
+    *tiles = (len / tile) & ~1ll;
+    if (*tiles < 2) *tiles = 2;
+    if (len / *tiles < 2) return false;
+    *of = malloc(sizeof(**of) * len);
+    for (int64_t i = 0; i < *tiles; ++i) {
+        for (int64_t v = i * len / *tiles; v < (i + 1) * len / *tiles; ++v) (*of)[v] = i;
+    }
+    return true;
+}
+
+void tiled_usage(const char *name) {
+    eprintf("Usage: %s [options]\n", name);
+    eprintf("    -t THREADS  Threads to run, 0 for one per CPU (default 0)\n");
+    eprintf("    -T CELLS    Width and height of the tiles (default 32)\n");
+    eprintf("    -g WxH      Size of the field (default %dx%d)\n", FIELD_W, FIELD_H);
+    eprintf("    -i CELLS    Random cells to start with (default %d)\n", INITIAL_CELLS_LEN);
+    eprintf("    -l COUNT    Synapses of every cell (default %d)\n", SYNAPSES_LEN);
+    eprintf("    -s SEED     Seed of the world (default 1)\n");
+    eprintf("    -n SWEEPS   Sweeps over the cells to run (default 100)\n");
+    eprintf("    -S          Split the tiles evenly between the threads regardless of their cells and don't steal, for NUMA placement\n");
+    eprintf("    -U          Don't pin the threads to CPUs\n");
+    eprintf("    -P PAGES    Keep the cells and the field in small, thp or huge (2 MB) pages, and print what we got (default small)\n");
+    exit(-1);
+}
+
+int main(int argc, char **argv) {
+    int64_t threads = 0;
+    int64_t tile = 32;
+    uint64_t seed = 1;
+    uint64_t sweeps = 100;
+    bool pin = true;
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "-t") && i + 1 < argc) threads = atoll(argv[++i]);
+        else if (!strcmp(argv[i], "-T") && i + 1 < argc) tile = atoll(argv[++i]);
+        else if (!strcmp(argv[i], "-g") && i + 1 < argc) { if (!parse_size(argv[++i], &field_w, &field_h)) tiled_usage(argv[0]); }
+        else if (!strcmp(argv[i], "-i") && i + 1 < argc) initial_cells_len = atoll(argv[++i]);
+        else if (!strcmp(argv[i], "-l") && i + 1 < argc) synapses_len = atoll(argv[++i]);
+        else if (!strcmp(argv[i], "-s") && i + 1 < argc) seed = atoll(argv[++i]);
+        else if (!strcmp(argv[i], "-n") && i + 1 < argc) sweeps = atoll(argv[++i]);
+        else if (!strcmp(argv[i], "-S")) tiled_static = true;
+        else if (!strcmp(argv[i], "-U")) pin = false;
+        else if (!strcmp(argv[i], "-P") && i + 1 < argc) { if (!parse_page_size(argv[++i], &page_size)) tiled_usage(argv[0]); }
+        else tiled_usage(argv[0]);
+    }
+    if (threads < 0 || tile < 2 || field_w < 1 || field_h < 1 || synapses_len < 0 || synapses_len > SYNAPSES_MAX ||
+        initial_cells_len < 0 || initial_cells_len > field_w * field_h) {
+        tiled_usage(argv[0]);
+    }
+    if (!cut_into_tiles(&column_tile, field_w, tile, &tiles_x) || !cut_into_tiles(&row_tile, field_h, tile, &tiles_y)) {
+        eprintf("The field must be at least 4x4 to cut into tiles\n");
+        return -1;
+    }
+
+    init_world();
+
+    tiled_tasks_len = tiles_x * tiles_y;
+    // Filled in by the threads, see first_touch
+    tiled_tasks = reserve(sizeof(*tiled_tasks) * tiled_tasks_len);
+    int64_t *order = malloc(sizeof(*order) * tiled_tasks_len);
+    int64_t *order_worker = malloc(sizeof(*order_worker) * tiled_tasks_len);
+
+    // One thread for every CPU we may run on
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    sched_getaffinity(0, sizeof(allowed), &allowed);
+    int *cpus = arr_create(int);
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) if (CPU_ISSET(cpu, &allowed)) arr_push(&cpus, cpu);
+    if (!threads) threads = arr_len(cpus) ? arr_len(cpus) : 1;
+
+    tiled_workers_len = threads;
+    tiled_workers = aligned_alloc(64, sizeof(*tiled_workers) * threads);
+    memset(tiled_workers, 0, sizeof(*tiled_workers) * threads);
+    pthread_barrier_init(&phase_start, NULL, threads + 1);
+    pthread_barrier_init(&phase_end, NULL, threads + 1);
+    for (int64_t i = 0; i < threads; ++i) {
+        struct Tiled_Worker *w = tiled_workers + i;
+        w->id = i;
+        w->cpu = pin && arr_len(cpus) ? cpus[i % arr_len(cpus)] : -1;
+        w->first_column = i * tiles_x / threads;
+        w->end_column = (i + 1) * tiles_x / threads;
+        pthread_mutex_init(&w->deque.mutex, NULL);
+        pthread_create(&w->thread, NULL, tiled_worker, w);
+    }
+    // The cells go on the field once the threads have touched it
+    pthread_barrier_wait(&phase_end);
+    seed_rand64(seed);
+    for (int64_t i = 0; i < initial_cells_len; ++i) create_random_cell();
+
+    printf("%ldx%ld field in %ldx%ld tiles, %ld cells, %lu sweeps on %ld threads\n",
+           field_w, field_h, tiles_x, tiles_y, cell_arena.len, sweeps, threads);
+#ifdef PROFILE
+    profile_start();
+#endif
+    const double start = tiled_now();
+    for (uint64_t i = 0; i < sweeps; ++i) tiled_sweep(order, order_worker);
+    const double seconds = tiled_now() - start;
+
+    tiled_stop = true;
+    pthread_barrier_wait(&phase_start);
+    for (int64_t i = 0; i < threads; ++i) pthread_join(tiled_workers[i].thread, NULL);
+#ifdef PROFILE
+    print_profile();
+#endif
+
+    // The spawns were counted here, the rest by the threads
+    struct Telemetry_Counters *c = &telemetry_counters;
+    uint64_t max_updates = 0;
+    for (int64_t i = 0; i < threads; ++i) {
+        const struct Tiled_Worker *w = tiled_workers + i;
+        c->births += w->counters.births;
+        c->starved += w->counters.starved;
+        c->eaten += w->counters.eaten;
+        c->moves += w->counters.moves;
+        c->sleeps += w->counters.sleeps;
+        c->wakes += w->counters.wakes;
+        if (w->updates > max_updates) max_updates = w->updates;
+    }
+
+    printf("%.3f s, %.0f updates/s, %ld cells\n", seconds, tick_count / seconds, cell_arena.len);
+    printf("spawns %lu births %lu starved %lu eaten %lu moves %lu sleeps %lu wakes %lu\n",
+           c->spawns, c->births, c->starved, c->eaten, c->moves, c->sleeps, c->wakes);
+    printf("%8s %6s %10s %10s %12s %8s\n", "thread", "cpu", "tiles", "steals", "updates", "busy %");
+    for (int64_t i = 0; i < threads; ++i) {
+        const struct Tiled_Worker *w = tiled_workers + i;
+        printf("%8ld %6d %10lu %10lu %12lu %8.1f\n", i, w->cpu, w->tasks, w->steals, w->updates, 100 * w->busy_seconds / seconds);
+    }
+    // How much longer the busiest thread took than if the updates were even
+    printf("imbalance %.3f\n", tick_count ? (double)max_updates * threads / tick_count : 1.);
+    printf("tick %lu hash %016lx\n", tick_count, hash_world());
+    if (page_size != PAGES_SMALL) print_page_sizes();
+    return 0;
+}
@@ -0,0 +1,189 @@
+#ifndef VIDEO_H_
+#define VIDEO_H_
+
+// Writes RGB frames as a raw Y4M or PPM stream, e.g. to pipe into ffmpeg.
+//
+// Frames are handed to a writer thread which converts and writes them, so the
+// caller never waits on the disk or the pipe. When all VIDEO_SLOTS frames are
+// still waiting to be written video_begin_frame returns NULL and the caller
+// should skip the frame.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#define VIDEO_SLOTS 4
+
+enum Video_Format {
+    VIDEO_Y4M,
+    VIDEO_PPM,
+};
+
+struct Video_Writer {
+    FILE *file;
+    enum Video_Format format;
+    int64_t w;
+    int64_t h;
+
+    pthread_t writer;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    bool closing;
+
+    // Slots are filled in order, the writer takes them in the same order
+    uint8_t *slots[VIDEO_SLOTS];
+    int64_t first_full;
+    int64_t full_len;
+
+    // The writer converts into this, it is reused for every frame
+    uint8_t *converted;
+
+    uint64_t frames_written;
+    uint64_t frames_skipped;
+};
+
+// Full range BT.601, as in JPEG
+uint8_t video_y (int r, int g, int b) { return (  19595 * r + 38470 * g +  7471 * b + 32768) >> 16; }
+uint8_t video_cb(int r, int g, int b) { return (-11059 * r - 21709 * g + 32768 * b + 32768 + (128 << 16)) >> 16; }
+uint8_t video_cr(int r, int g, int b) { return ( 32768 * r - 27439 * g -  5329 * b + 32768 + (128 << 16)) >> 16; }
+
+// 4:2:0 needs even dimensions, otherwise we don't subsample
+bool video_subsampled(struct Video_Writer *v) {
+    return v->w % 2 == 0 && v->h % 2 == 0;
+}
+
+size_t video_convert_y4m(struct Video_Writer *v, const uint8_t *rgb) {
+    const int64_t w = v->w, h = v->h;
+    uint8_t *out = v->converted;
+    memcpy(out, "FRAME\n", 6);
+    out += 6;
+
+    uint8_t *y_plane = out;
+    for (int64_t i = 0; i < w * h; ++i) y_plane[i] = video_y(rgb[3 * i], rgb[3 * i + 1], rgb[3 * i + 2]);
+    out += w * h;
+
+    if (!video_subsampled(v)) {
+        uint8_t *cb_plane = out, *cr_plane = out + w * h;
+        for (int64_t i = 0; i < w * h; ++i) {
+            cb_plane[i] = video_cb(rgb[3 * i], rgb[3 * i + 1], rgb[3 * i + 2]);
+            cr_plane[i] = video_cr(rgb[3 * i], rgb[3 * i + 1], rgb[3 * i + 2]);
+        }
+        return 6 + 3 * w * h;
+    }
+
+    // Chroma of the average of every 2x2 block
+    uint8_t *cb_plane = out, *cr_plane = out + w * h / 4;
+    for (int64_t y = 0; y < h; y += 2) {
+        for (int64_t x = 0; x < w; x += 2) {
+            const uint8_t *p = rgb + 3 * (y * w + x), *q = p + 3 * w;
+            const int r = (p[0] + p[3] + q[0] + q[3] + 2) / 4;
+            const int g = (p[1] + p[4] + q[1] + q[4] + 2) / 4;
+            const int b = (p[2] + p[5] + q[2] + q[5] + 2) / 4;
+            cb_plane[y / 2 * w / 2 + x / 2] = video_cb(r, g, b);
+            cr_plane[y / 2 * w / 2 + x / 2] = video_cr(r, g, b);
+        }
+    }
+    return 6 + w * h * 3 / 2;
+}
+
+void *video_writer(void *arg) {
+    struct Video_Writer *v = arg;
+
+    pthread_mutex_lock(&v->mutex);
+    while (1) {
+        while (!v->full_len && !v->closing) pthread_cond_wait(&v->cond, &v->mutex);
+        if (!v->full_len) break;
+        const uint8_t *rgb = v->slots[v->first_full];
+        pthread_mutex_unlock(&v->mutex);
+
+        bool ok;
+        if (v->format == VIDEO_Y4M) {
+            ok = fwrite(v->converted, video_convert_y4m(v, rgb), 1, v->file) == 1;
+        } else {
+            ok = fprintf(v->file, "P6\n%ld %ld\n255\n", v->w, v->h) > 0 &&
+                 fwrite(rgb, 3 * v->w * v->h, 1, v->file) == 1;
+        }
+        if (!ok) fprintf(stderr, "Could not write a video frame\n");
+
+        pthread_mutex_lock(&v->mutex);
+        v->first_full = (v->first_full + 1) % VIDEO_SLOTS;
+        --v->full_len;
+        ++v->frames_written;
+    }
+    pthread_mutex_unlock(&v->mutex);
+
+    return NULL;
+}
+
+// A path of "-" writes to stdout. Anything else printed to stdout goes to
+// stderr from then on, so it doesn't end up in the middle of the stream. The
+// frames are played fps_num / fps_den a second.
+struct Video_Writer *video_open(const char *path, enum Video_Format format, int64_t w, int64_t h, int64_t fps_num, int64_t fps_den) {
+    FILE *f;
+    if (strcmp(path, "-")) {
+        f = fopen(path, "wb");
+    } else {
+        fflush(stdout);
+        f = fdopen(dup(STDOUT_FILENO), "wb");
+        dup2(STDERR_FILENO, STDOUT_FILENO);
+    }
+    if (!f) return NULL;
+    setvbuf(f, NULL, _IOFBF, 1 << 22);
+
+    struct Video_Writer *v = calloc(1, sizeof(*v));
+    v->file = f;
+    v->format = format;
+    v->w = w;
+    v->h = h;
+    for (int64_t i = 0; i < VIDEO_SLOTS; ++i) v->slots[i] = malloc(3 * w * h);
+    v->converted = malloc(6 + 3 * w * h);
+
+    if (format == VIDEO_Y4M) {
+        fprintf(f, "YUV4MPEG2 W%ld H%ld F%ld:%ld Ip A1:1 %s\n", w, h, fps_num, fps_den, video_subsampled(v) ? "C420jpeg" : "C444");
+    }
+
+    pthread_mutex_init(&v->mutex, NULL);
+    pthread_cond_init(&v->cond, NULL);
+    pthread_create(&v->writer, NULL, video_writer, v);
+    return v;
+}
+
+// Returns where to put the next frame as w * h RGB triplets, or NULL when
+// the writer is behind and the frame should be skipped
+uint8_t *video_begin_frame(struct Video_Writer *v) {
+    pthread_mutex_lock(&v->mutex);
+    uint8_t *slot = NULL;
+    if (v->full_len < VIDEO_SLOTS) slot = v->slots[(v->first_full + v->full_len) % VIDEO_SLOTS];
+    else ++v->frames_skipped;
+    pthread_mutex_unlock(&v->mutex);
+    return slot;
+}
+
+void video_end_frame(struct Video_Writer *v) {
+    pthread_mutex_lock(&v->mutex);
+    ++v->full_len;
+    pthread_cond_signal(&v->cond);
+    pthread_mutex_unlock(&v->mutex);
+}
+
+// Writes out the frames still waiting and closes the stream
+void video_close(struct Video_Writer *v) {
+    pthread_mutex_lock(&v->mutex);
+    v->closing = true;
+    pthread_cond_signal(&v->cond);
+    pthread_mutex_unlock(&v->mutex);
+    pthread_join(v->writer, NULL);
+
+    fclose(v->file);
+    for (int64_t i = 0; i < VIDEO_SLOTS; ++i) free(v->slots[i]);
+    free(v->converted);
+    pthread_mutex_destroy(&v->mutex);
+    pthread_cond_destroy(&v->cond);
+    free(v);
+}
+
+#endif // VIDEO_H_
@@ -0,0 +1,166 @@
+// Runs whole worlds from a fixed seed for a number of sweeps over the cells
+// and reports how fast they went, how much memory they took and a hash of
+// where they ended up. A change that should not change the simulation must
+// leave the hashes as they were.
+//
+// Every world runs in its own process so the peak RSS is its own, and every
+// density is run on every field size.
+
+#define main eco_main
+#include "game.c"
+#undef main
+
+#include <sys/resource.h>
+
+struct World_Result {
+    int64_t field_w;
+    int64_t field_h;
+    double density;
+    int64_t initial_cells;
+    int64_t final_cells;
+    uint64_t ticks;
+    double seconds;
+    int64_t peak_rss_kb;
+    uint64_t hash;
+};
+
+void run_world(uint64_t seed, double density, uint64_t sweeps, struct World_Result *r) {
+    init_world();
+    srand64(seed);
+    r->field_w = field_w;
+    r->field_h = field_h;
+    r->density = density;
+    const int64_t cells = density * field_w * field_h;
+    for (int64_t i = 0; i < cells; ++i) create_random_cell();
+    r->initial_cells = cell_arena.len;
+
+    const uint64_t start = get_timestamp();
+    uint64_t done = 0;
+    while (done < sweeps) {
+        do_tick();
+        if (!tick_cursor) ++done;
+    }
+    r->seconds = (get_timestamp() - start) / 1e9;
+
+    r->ticks = tick_count;
+    r->final_cells = cell_arena.len;
+    r->hash = hash_world();
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    r->peak_rss_kb = usage.ru_maxrss;
+}
+
+bool run_world_in_child(uint64_t seed, double density, uint64_t sweeps, struct World_Result *r) {
+    int fds[2];
+    if (pipe(fds)) return false;
+    fflush(stdout);
+    const pid_t pid = fork();
+    if (pid < 0) return false;
+    if (!pid) {
+        close(fds[0]);
+        run_world(seed, density, sweeps, r);
+        _exit(write(fds[1], r, sizeof(*r)) == sizeof(*r) ? 0 : 1);
+    }
+    close(fds[1]);
+    const bool ok = read(fds[0], r, sizeof(*r)) == sizeof(*r);
+    close(fds[0]);
+    int status;
+    waitpid(pid, &status, 0);
+    return ok && WIFEXITED(status) && !WEXITSTATUS(status);
+}
+
+const char *size_name(const struct World_Result *r) {
+    static char name[64];
+    snprintf(name, sizeof(name), "%ldx%ld", r->field_w, r->field_h);
+    return name;
+}
+
+void world_bench_usage(const char *name) {
+    eprintf("Usage: %s [options]\n", name);
+    eprintf("    -s SEED       Seed of every world (default 1)\n");
+    eprintf("    -n SWEEPS     Sweeps over the cells to run every world for (default 100)\n");
+    eprintf("    -d DENSITIES  Comma separated fractions of the field to start with cells (default 0.002,0.02,0.2)\n");
+    eprintf("    -g SIZES      Comma separated field sizes as WxH (default %dx%d)\n", FIELD_W, FIELD_H);
+    eprintf("    -S            Run the worlds on sparse fields\n");
+    eprintf("    -q            Run the brains in fixed point\n");
+    eprintf("    -j PATH       Also write the results to PATH as JSON\n");
+    exit(-1);
+}
+
+int main(int argc, char **argv) {
+    uint64_t seed = 1;
+    uint64_t sweeps = 100;
+    const char *densities = "0.002,0.02,0.2";
+    const char *sizes = NULL;
+    const char *json_path = NULL;
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "-s") && i + 1 < argc) seed = atoll(argv[++i]);
+        else if (!strcmp(argv[i], "-n") && i + 1 < argc) sweeps = atoll(argv[++i]);
+        else if (!strcmp(argv[i], "-d") && i + 1 < argc) densities = argv[++i];
+        else if (!strcmp(argv[i], "-g") && i + 1 < argc) sizes = argv[++i];
+        else if (!strcmp(argv[i], "-S")) sparse_field = true;
+        else if (!strcmp(argv[i], "-q")) quantised_brains = true;
+        else if (!strcmp(argv[i], "-j") && i + 1 < argc) json_path = argv[++i];
+        else world_bench_usage(argv[0]);
+    }
+
+    struct World_Result *results = arr_create(struct World_Result);
+    for (const char *s = sizes; !s || *s; ) {
+        if (s) {
+            char *end;
+            field_w = strtoll(s, &end, 10);
+            if (*end != 'x') world_bench_usage(argv[0]);
+            field_h = strtoll(end + 1, &end, 10);
+            if (field_w < 1 || field_h < 1) world_bench_usage(argv[0]);
+            s = *end == ',' ? end + 1 : end;
+        }
+
+        for (const char *p = densities; *p; ) {
+            char *end;
+            const double density = strtod(p, &end);
+            if (end == p || density < 0 || density > 1) world_bench_usage(argv[0]);
+            p = *end == ',' ? end + 1 : end;
+
+            struct World_Result r;
+            if (!run_world_in_child(seed, density, sweeps, &r)) {
+                eprintf("The %ldx%ld world with density %g failed\n", field_w, field_h, density);
+                return -1;
+            }
+            arr_push(&results, r);
+        }
+        if (!s) break;
+    }
+
+    printf("seed %lu, %lu sweeps\n", seed, sweeps);
+    printf("%10s %8s %10s %10s %12s %10s %12s %14s %12s %16s\n",
+           "size", "density", "cells", "final", "ticks", "seconds", "sweeps/s", "updates/s", "peak MB", "hash");
+    for (int64_t i = 0; i < arr_len(results); ++i) {
+        const struct World_Result *r = results + i;
+        printf("%10s %8g %10ld %10ld %12lu %10.3f %12.2f %14.0f %12.1f %016lx\n",
+               size_name(r), r->density, r->initial_cells, r->final_cells, r->ticks, r->seconds,
+               sweeps / r->seconds, r->ticks / r->seconds, r->peak_rss_kb / 1024., r->hash);
+    }
+
+    if (json_path) {
+        FILE *f = fopen(json_path, "w");
+        if (!f) {
+            eprintf("Could not open %s\n", json_path);
+            return -1;
+        }
+        fprintf(f, "{\n  \"seed\": %lu,\n  \"sweeps\": %lu,\n  \"worlds\": [\n", seed, sweeps);
+        for (int64_t i = 0; i < arr_len(results); ++i) {
+            const struct World_Result *r = results + i;
+            fprintf(f, "    {\"field_w\": %ld, \"field_h\": %ld, \"density\": %g, \"initial_cells\": %ld, \"final_cells\": %ld, \"ticks\": %lu, \"seconds\": %.6f, "
+                       "\"sweeps_per_second\": %.3f, \"cell_updates_per_second\": %.1f, \"peak_rss_kb\": %ld, \"hash\": \"%016lx\"}%s\n",
+                    r->field_w, r->field_h, r->density, r->initial_cells, r->final_cells, r->ticks, r->seconds,
+                    sweeps / r->seconds, r->ticks / r->seconds, r->peak_rss_kb, r->hash,
+                    i + 1 < arr_len(results) ? "," : "");
+        }
+        fprintf(f, "  ]\n}\n");
+        if (fclose(f)) {
+            eprintf("Could not write %s\n", json_path);
+            return -1;
+        }
+    }
+    return 0;
+}